@@ -32,18 +32,18 @@
  */
 ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
 												 uint64_t value, Thread *thread) :
+	type(type),
+	order(order),
+	seq_number(ACTION_INITIAL_CLOCK),
 	location(loc),
-	position(NULL),
-	reads_from(NULL),
-	last_fence_release(NULL),
 	cv(NULL),
+	reads_from(NULL),
+	value(value),
 	rf_cv(NULL),
+	last_fence_release(NULL),
 	action_ref(NULL),
-	value(value),
-	type(type),
-	order(order),
-	original_order(order),
-	seq_number(ACTION_INITIAL_CLOCK)
+	position(NULL),
+	original_order(order)
 {
 	/* References to NULL atomic variables can end up here */
 	ASSERT(loc || type == ATOMIC_FENCE || type == ATOMIC_NOP);
@@ -64,18 +64,18 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
  * @param _time The this sleep action is constructed
  */
 ModelAction::ModelAction(action_type_t type, memory_order order, uint64_t value, uint64_t _time) :
+	type(type),
+	order(order),
+	seq_number(ACTION_INITIAL_CLOCK),
 	location(NULL),
-	position(NULL),
-	time(_time),
-	last_fence_release(NULL),
 	cv(NULL),
+	time(_time),
+	value(value),
 	rf_cv(NULL),
+	last_fence_release(NULL),
 	action_ref(NULL),
-	value(value),
-	type(type),
-	order(order),
-	original_order(order),
-	seq_number(ACTION_INITIAL_CLOCK)
+	position(NULL),
+	original_order(order)
 {
 	Thread *t = thread_current();
 	this->tid = t!= NULL ? t->get_id() : -1;
@@ -95,18 +95,18 @@ ModelAction::ModelAction(action_type_t type, memory_order order, uint64_t value,
  */
 ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
 												 uint64_t value, int size) :
+	type(type),
+	order(order),
+	seq_number(ACTION_INITIAL_CLOCK),
 	location(loc),
-	position(NULL),
-	reads_from(NULL),
-	last_fence_release(NULL),
 	cv(NULL),
+	reads_from(NULL),
+	value(value),
 	rf_cv(NULL),
+	last_fence_release(NULL),
 	action_ref(NULL),
-	value(value),
-	type(type),
-	order(order),
-	original_order(order),
-	seq_number(ACTION_INITIAL_CLOCK)
+	position(NULL),
+	original_order(order)
 {
 	/* References to NULL atomic variables can end up here */
 	ASSERT(loc);
@@ -129,18 +129,18 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
  */
 ModelAction::ModelAction(action_type_t type, const char * position, memory_order order, void *loc,
 												 uint64_t value, int size) :
+	type(type),
+	order(order),
+	seq_number(ACTION_INITIAL_CLOCK),
 	location(loc),
-	position(position),
-	reads_from(NULL),
-	last_fence_release(NULL),
 	cv(NULL),
+	reads_from(NULL),
+	value(value),
 	rf_cv(NULL),
+	last_fence_release(NULL),
 	action_ref(NULL),
-	value(value),
-	type(type),
-	order(order),
-	original_order(order),
-	seq_number(ACTION_INITIAL_CLOCK)
+	position(position),
+	original_order(order)
 {
 	/* References to NULL atomic variables can end up here */
 	ASSERT(loc);
@@ -164,18 +164,18 @@ ModelAction::ModelAction(action_type_t type, const char * position, memory_order
  */
 ModelAction::ModelAction(action_type_t type, const char * position, memory_order order,
 												 void *loc, uint64_t value, Thread *thread) :
+	type(type),
+	order(order),
+	seq_number(ACTION_INITIAL_CLOCK),
 	location(loc),
-	position(position),
-	reads_from(NULL),
-	last_fence_release(NULL),
 	cv(NULL),
+	reads_from(NULL),
+	value(value),
 	rf_cv(NULL),
+	last_fence_release(NULL),
 	action_ref(NULL),
-	value(value),
-	type(type),
-	order(order),
-	original_order(order),
-	seq_number(ACTION_INITIAL_CLOCK)
+	position(position),
+	original_order(order)
 {
 	/* References to NULL atomic variables can end up here */
 	ASSERT(loc || type == ATOMIC_FENCE);
@@ -192,22 +192,50 @@ public:
 	void set_value(uint64_t val) { value = val; }
 
 	/* to accomodate pthread create and join */
-	Thread * thread_operand;
 	void set_thread_operand(Thread *th) { thread_operand = th; }
 
 	void setActionRef(sllnode<ModelAction *> *ref) { action_ref = ref; }
 	sllnode<ModelAction *> * getActionRef() { return action_ref; }
 
-	SNAPSHOTALLOC
+	SLABALLOC(ModelAction)
 private:
 	const char * get_type_str() const;
 	const char * get_mo_str() const;
 
+	/*
+	 * The fields read by the hot checks (type, order, thread, sequence
+	 * number, location and clock vector) come first, so they share one
+	 * 32-byte block; see SnapshotSlab for the alignment.
+	 */
+
+	/** @brief Type of action (read, write, RMW, fence, thread create, etc.) */
+	action_type type;
+
+	/** @brief The memory order for this operation. */
+	memory_order order;
+
+	/** @brief The thread id that performed this action. */
+	thread_id_t tid;
+
+	/**
+	 * @brief The sequence number of this action
+	 *
+	 * Except for non atomic write actions, this number should be unique and
+	 * should represent the action's position in the execution order.
+	 */
+	modelclock_t seq_number;
+
 	/** @brief A pointer to the memory location for this action. */
 	void *location;
 
-	/** @brief A pointer to the source line for this atomic action. */
-	const char * position;
+	/**
+	 * @brief The clock vector for this operation
+	 *
+	 * Technically, this is only needed for potentially synchronizing
+	 * (e.g., non-relaxed) operations, but it is very handy to have these
+	 * vectors for all operations.
+	 */
+	ClockVector *cv;
 
 	union {
 		/**
@@ -220,42 +248,24 @@ private:
 		uint64_t time;	//used for sleep
 	};
 
+	/** @brief The value written (for write or RMW; undefined for read) */
+	uint64_t value;
+
+	ClockVector *rf_cv;
+
 	/** @brief The last fence release from the same thread */
 	const ModelAction *last_fence_release;
 
-	/**
-	 * @brief The clock vector for this operation
-	 *
-	 * Technically, this is only needed for potentially synchronizing
-	 * (e.g., non-relaxed) operations, but it is very handy to have these
-	 * vectors for all operations.
-	 */
-	ClockVector *cv;
-	ClockVector *rf_cv;
 	sllnode<ModelAction *> * action_ref;
 
-	/** @brief The value written (for write or RMW; undefined for read) */
-	uint64_t value;
-
-	/** @brief Type of action (read, write, RMW, fence, thread create, etc.) */
-	action_type type;
+	/** @brief A pointer to the source line for this atomic action. */
+	const char * position;
 
-	/** @brief The memory order for this operation. */
-	memory_order order;
+	/** @brief The thread created or joined, for thread actions */
+	Thread * thread_operand;
 
 	/** @brief The original memory order parameter for this operation. */
 	memory_order original_order;
-
-	/** @brief The thread id that performed this action. */
-	thread_id_t tid;
-
-	/**
-	 * @brief The sequence number of this action
-	 *
-	 * Except for non atomic write actions, this number should be unique and
-	 * should represent the action's position in the execution order.
-	 */
-	modelclock_t seq_number;
 };
 
 #endif	/* __ACTION_H__ */
@@ -8,6 +8,7 @@ actionlist::actionlist() :
 	root(),
 	head(NULL),
 	tail(NULL),
+	frontier(),
 	_size(0)
 {
 }
@@ -213,6 +214,10 @@ void actionlist::removeAction(ModelAction * act) {
 					decrementCount(oldptr);
 				}
 			}
+			/* Keep cached frontiers valid */
+			for (uint i = 0;i < frontier.size();i++)
+				if (frontier[i] == llnode)
+					frontier[i] = llnodeprev;
 			delete llnode;
 			_size--;
 			return;
@@ -224,6 +229,29 @@ void actionlist::removeAction(ModelAction * act) {
 	return;
 }
 
+/** @return The list node stored in a leaf slot of the trie */
+static inline sllnode<ModelAction *> * leafNode(allnode * ptr) {
+	return reinterpret_cast<sllnode<ModelAction *> *>(((uintptr_t) ptr) & ACTMASK);
+}
+
+/**
+ * Looks up an action by sequence number using the trie.
+ * @return The list node of the last action added with the given clock, or
+ * NULL if there is none
+ */
+sllnode<ModelAction *> * actionlist::find(modelclock_t clock) {
+	int shiftbits = MODELCLOCKBITS;
+	allnode * ptr = &root;
+
+	while(shiftbits != 0) {
+		shiftbits -= ALLBITS;
+		ptr = ptr->children[(clock >> shiftbits) & ALLMASK];
+		if (ptr == NULL)
+			return NULL;
+	}
+	return leafNode(ptr);
+}
+
 void actionlist::clear() {
 	for(uint i = 0;i < ALLNODESIZE;i++) {
 		if (root.children[i] != NULL) {
@@ -238,6 +266,7 @@ void actionlist::clear() {
 		head = tmp;
 	}
 	tail = NULL;
+	frontier.clear();
 
 	root.count = 0;
 	_size = 0;
@@ -259,3 +288,82 @@ void actionlist::fixupParent()
 			child->parent = &root;
 	}
 }
+
+/**
+ * Finds the last action whose sequence number is at most clock, by walking
+ * the trie down along clock's digits and, where the path ends, backing up
+ * to the nearest smaller sibling and taking its rightmost leaf.
+ * @return The list node of that action, or NULL if there is none
+ */
+sllnode<ModelAction *> * actionlist::findAtOrBefore(modelclock_t clock) {
+	if (tail == NULL || tail->val->get_seq_number() <= clock)
+		return tail;
+
+	allnode * path[MODELCLOCKBITS / ALLBITS];
+	int level = 0;
+	int shiftbits = MODELCLOCKBITS;
+	allnode * ptr = &root;
+	while(shiftbits != 0) {
+		shiftbits -= ALLBITS;
+		path[level++] = ptr;
+		allnode * child = ptr->children[(clock >> shiftbits) & ALLMASK];
+		if (child == NULL)
+			break;
+		if (shiftbits == 0)
+			return leafNode(child);
+		ptr = child;
+	}
+
+	/* Back up to the deepest level with a smaller nonempty sibling */
+	while(level > 0) {
+		level--;
+		ptr = path[level];
+		shiftbits = MODELCLOCKBITS - (level + 1) * ALLBITS;
+		int i = (int)((clock >> shiftbits) & ALLMASK) - 1;
+		while(i >= 0 && ptr->children[i] == NULL)
+			i--;
+		if (i < 0)
+			continue;
+		ptr = ptr->children[i];
+		/* Descend along the rightmost children */
+		while(shiftbits != 0) {
+			shiftbits -= ALLBITS;
+			i = ALLMASK;
+			while(ptr->children[i] == NULL)
+				i--;
+			ptr = ptr->children[i];
+		}
+		return leafNode(ptr);
+	}
+	return NULL;
+}
+
+/**
+ * Finds the last action whose sequence number is at most clock, for a
+ * reader whose clock only grows between calls.  The previous result for
+ * the reader is cached, so a call usually only steps over the actions
+ * that entered the reader's view since the last one.
+ * @param reader Index of the querying thread
+ * @return The list node of that action, or NULL if there is none
+ */
+sllnode<ModelAction *> * actionlist::findFrontier(unsigned int reader, modelclock_t clock) {
+	if (tail == NULL || tail->val->get_seq_number() <= clock)
+		return tail;
+	if (frontier.size() <= reader)
+		frontier.resize(reader + 1);
+
+	sllnode<ModelAction *> * node = frontier[reader];
+	if (node != NULL && node->val->get_seq_number() <= clock) {
+		for (int step = 0;node != NULL;step++) {
+			sllnode<ModelAction *> * next = node->next;
+			if (next->val->get_seq_number() > clock)
+				break;
+			node = step < FRONTIER_MAXSTEP ? next : NULL;
+		}
+	} else
+		node = NULL;
+	if (node == NULL)
+		node = findAtOrBefore(clock);
+	frontier[reader] = node;
+	return node;
+}
@@ -12,6 +12,10 @@
 #define ALLMASK ((1 << ALLBITS)-1)
 #define MODELCLOCKBITS 32
 
+/** @brief Most steps findFrontier walks forward from a cached frontier
+ *  before falling back to a search of the trie */
+#define FRONTIER_MAXSTEP 8
+
 class allnode;
 void decrementCount(allnode *);
 
@@ -30,6 +34,15 @@ private:
 	friend void decrementCount(allnode *);
 };
 
+/**
+ * @brief A list of actions ordered by sequence number
+ *
+ * The allnode trie indexes the list by sequence number.  It answers exact
+ * lookups (find), predecessor queries (findAtOrBefore, findFrontier) and
+ * insertion points in a fixed number of steps.  It does not keep subtree
+ * sizes, so there is no k-th element query; range scans start from a
+ * lookup and follow the list.
+ */
 class actionlist {
 public:
 	actionlist();
@@ -41,6 +54,9 @@ public:
 	uint size() {return _size;}
 	sllnode<ModelAction *> * begin() {return head;}
 	sllnode<ModelAction *> * end() {return tail;}
+	sllnode<ModelAction *> * find(modelclock_t clock);
+	sllnode<ModelAction *> * findAtOrBefore(modelclock_t clock);
+	sllnode<ModelAction *> * findFrontier(unsigned int reader, modelclock_t clock);
 	void fixupParent();
 
 	SNAPSHOTALLOC;
@@ -50,6 +66,9 @@ private:
 	sllnode<ModelAction *> * head;
 	sllnode<ModelAction* > * tail;
 
+	/** @brief The last result of findFrontier for each reader thread */
+	SnapVector<sllnode<ModelAction *> *> frontier;
+
 	uint _size;
 };
 #endif
@@ -8,23 +8,61 @@
 #include "threads-model.h"
 
 
+/** Allocates a zeroed clock store for num_threads entries. */
+static ClockStore * alloc_store(int num_threads)
+{
+	ClockStore *store = (ClockStore *)snapshot_calloc(1, sizeof(ClockStore) + num_threads * sizeof(modelclock_t));
+	store->refcount = 1;
+	return store;
+}
+
 /**
  * Constructs a new ClockVector, given a parent ClockVector and a first
  * ModelAction. This constructor can assign appropriate default settings if no
  * parent and/or action is supplied.
+ *
+ * Vectors that have outgrown the inline buffer share the parent's store
+ * when they differ from it in at most act's entry, which is then kept in
+ * own_clock.  The store is copied on the first merge that changes it.
+ *
  * @param parent is the previous ClockVector to inherit (i.e., clock from the
  * same thread or the parent that created this thread)
  * @param act is an action with which to update the ClockVector
  */
-ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
+ClockVector::ClockVector(ClockVector *parent, const ModelAction *act) :
+	store(NULL),
+	own(-1),
+	own_clock(0)
 {
 	num_threads = act != NULL ? int_to_id(act->get_tid()) + 1 : 0;
 	if (parent && parent->num_threads > num_threads)
 		num_threads = parent->num_threads;
 
-	clock = (modelclock_t *)snapshot_calloc(num_threads, sizeof(int));
-	if (parent)
+	if (parent != NULL && parent->store != NULL && parent->num_threads == num_threads) {
+		int tid = act != NULL ? id_to_int(act->get_tid()) : parent->own;
+		if (parent->own == -1 || parent->own == tid) {
+			store = parent->store;
+			store->refcount++;
+			clock = parent->clock;
+			own = tid;
+			own_clock = act != NULL ? act->get_seq_number() : parent->own_clock;
+			return;
+		}
+	}
+
+	if (num_threads <= CV_INLINE_THREADS) {
+		clock = inline_clock;
+		for (int i = 0;i < CV_INLINE_THREADS;i++)
+			clock[i] = 0;
+	} else {
+		store = alloc_store(num_threads);
+		clock = store->clock;
+	}
+	if (parent) {
 		real_memcpy(clock, parent->clock, parent->num_threads * sizeof(modelclock_t));
+		if (parent->own != -1)
+			clock[parent->own] = parent->own_clock;
+	}
 
 	if (act != NULL)
 		clock[id_to_int(act->get_tid())] = act->get_seq_number();
@@ -33,7 +71,138 @@ ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
 /** @brief Destructor */
 ClockVector::~ClockVector()
 {
-	snapshot_free(clock);
+	if (store != NULL && --store->refcount == 0)
+		snapshot_free(store);
+}
+
+/** Gets the clock for a thread index, accounting for own_clock. */
+inline modelclock_t ClockVector::get(int threadid) const
+{
+	if (threadid == own)
+		return own_clock;
+	if (threadid < num_threads)
+		return clock[threadid];
+	return 0;
+}
+
+/** Checks whether cv has a later clock than this vector for any thread. */
+bool ClockVector::has_newer(const ClockVector *cv) const
+{
+	for (int i = 0;i < cv->num_threads;i++)
+		if (cv->get(i) > get(i))
+			return true;
+	return false;
+}
+
+/**
+ * Tries to merge cv by sharing its store.  This works when cv's clocks are
+ * at least ours for every thread but one, whose clock then lives in
+ * own_clock; that is the common case when merging along a chain.
+ * @param cv is the ClockVector being merged into this vector.
+ * @param changed is set to whether the merge changed this vector
+ * @return false if the merge has to be done element-wise instead
+ */
+bool ClockVector::try_share(const ClockVector *cv, bool *changed)
+{
+	if (cv->store == NULL || cv == this || cv->num_threads < num_threads)
+		return false;
+
+	int keep = -1;
+	bool newer = false;
+	for (int i = 0;i < cv->num_threads;i++) {
+		modelclock_t ours = get(i);
+		modelclock_t theirs = cv->get(i);
+		if (ours > theirs) {
+			if (keep != -1)
+				return false;
+			keep = i;
+		} else if (theirs > ours)
+			newer = true;
+	}
+	if (keep == -1)
+		keep = cv->own;
+	else if (cv->own != -1 && cv->own != keep)
+		return false;
+
+	modelclock_t keep_clock = 0;
+	if (keep != -1)
+		keep_clock = get(keep) > cv->get(keep) ? get(keep) : cv->get(keep);
+	cv->store->refcount++;
+	if (store != NULL && --store->refcount == 0)
+		snapshot_free(store);
+	store = cv->store;
+	clock = cv->clock;
+	num_threads = cv->num_threads;
+	own = keep;
+	own_clock = keep_clock;
+	*changed = newer;
+	return true;
+}
+
+/**
+ * Gives this vector private, exact storage for at least new_threads entries
+ * before it is modified, copying a shared store and zeroing new entries.
+ * @param new_threads is the length the vector must have
+ */
+void ClockVector::prepare_write(int new_threads)
+{
+	if (new_threads < num_threads)
+		new_threads = num_threads;
+
+	if (store != NULL && store->refcount > 1) {
+		ClockStore *copy = alloc_store(new_threads);
+		real_memcpy(copy->clock, clock, num_threads * sizeof(modelclock_t));
+		store->refcount--;
+		store = copy;
+		clock = store->clock;
+	} else if (new_threads > num_threads) {
+		/* The inline buffer is kept zeroed past num_threads */
+		if (new_threads > CV_INLINE_THREADS) {
+			if (store == NULL) {
+				store = alloc_store(new_threads);
+				real_memcpy(store->clock, inline_clock, num_threads * sizeof(modelclock_t));
+			} else {
+				store = (ClockStore *)snapshot_realloc(store, sizeof(ClockStore) + new_threads * sizeof(modelclock_t));
+				for (int i = num_threads;i < new_threads;i++)
+					store->clock[i] = 0;
+			}
+			clock = store->clock;
+		}
+	}
+	num_threads = new_threads;
+
+	if (own != -1) {
+		clock[own] = own_clock;
+		own = -1;
+	}
+}
+
+/** Element-wise maximum of src into dst over [begin, end); branch-free so
+ * that the compiler vectorizes it.  Returns non-zero if dst changed. */
+static inline modelclock_t max_range(modelclock_t *dst, const modelclock_t *src, int begin, int end)
+{
+	modelclock_t changed = 0;
+	for (int i = begin;i < end;i++) {
+		modelclock_t old = dst[i];
+		modelclock_t val = src[i] > old ? src[i] : old;
+		changed |= val ^ old;
+		dst[i] = val;
+	}
+	return changed;
+}
+
+/** Element-wise minimum of src into dst over [begin, end); branch-free so
+ * that the compiler vectorizes it.  Returns non-zero if dst changed. */
+static inline modelclock_t min_range(modelclock_t *dst, const modelclock_t *src, int begin, int end)
+{
+	modelclock_t changed = 0;
+	for (int i = begin;i < end;i++) {
+		modelclock_t old = dst[i];
+		modelclock_t val = src[i] < old ? src[i] : old;
+		changed |= val ^ old;
+		dst[i] = val;
+	}
+	return changed;
 }
 
 /**
@@ -44,22 +213,27 @@ ClockVector::~ClockVector()
 bool ClockVector::merge(const ClockVector *cv)
 {
 	ASSERT(cv != NULL);
-	bool changed = false;
-	if (cv->num_threads > num_threads) {
-		clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-		for (int i = num_threads;i < cv->num_threads;i++)
-			clock[i] = 0;
-		num_threads = cv->num_threads;
-	}
+	bool shared_changed;
+	if (try_share(cv, &shared_changed))
+		return shared_changed;
+	/* Don't copy a shared store for a merge that changes nothing */
+	if ((own != -1 || (store != NULL && store->refcount > 1)) && !has_newer(cv))
+		return false;
+	prepare_write(cv->num_threads);
 
-	/* Element-wise maximum */
-	for (int i = 0;i < cv->num_threads;i++)
-		if (cv->clock[i] > clock[i]) {
-			clock[i] = cv->clock[i];
-			changed = true;
+	/* cv's own entry is not in its clock array */
+	int n = cv->num_threads;
+	int skip = cv->own != -1 ? cv->own : n;
+	modelclock_t changed = max_range(clock, cv->clock, 0, skip);
+	if (skip < n) {
+		changed |= max_range(clock, cv->clock, skip + 1, n);
+		if (cv->own_clock > clock[skip]) {
+			clock[skip] = cv->own_clock;
+			changed = 1;
 		}
+	}
 
-	return changed;
+	return changed != 0;
 }
 
 /**
@@ -70,22 +244,21 @@ bool ClockVector::merge(const ClockVector *cv)
 bool ClockVector::minmerge(const ClockVector *cv)
 {
 	ASSERT(cv != NULL);
-	bool changed = false;
-	if (cv->num_threads > num_threads) {
-		clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-		for (int i = num_threads;i < cv->num_threads;i++)
-			clock[i] = 0;
-		num_threads = cv->num_threads;
-	}
+	prepare_write(cv->num_threads);
 
-	/* Element-wise minimum */
-	for (int i = 0;i < cv->num_threads;i++)
-		if (cv->clock[i] < clock[i]) {
-			clock[i] = cv->clock[i];
-			changed = true;
+	/* cv's own entry is not in its clock array */
+	int n = cv->num_threads;
+	int skip = cv->own != -1 ? cv->own : n;
+	modelclock_t changed = min_range(clock, cv->clock, 0, skip);
+	if (skip < n) {
+		changed |= min_range(clock, cv->clock, skip + 1, n);
+		if (cv->own_clock < clock[skip]) {
+			clock[skip] = cv->own_clock;
+			changed = 1;
 		}
+	}
 
-	return changed;
+	return changed != 0;
 }
 
 /**
@@ -105,18 +278,13 @@ bool ClockVector::synchronized_since(const ModelAction *act) const
 	int i = id_to_int(act->get_tid());
 
 	if (i < num_threads)
-		return act->get_seq_number() <= clock[i];
+		return act->get_seq_number() <= get(i);
 	return false;
 }
 
 /** Gets the clock corresponding to a given thread id from the clock vector. */
-modelclock_t ClockVector::getClock(thread_id_t thread) {
-	int threadid = id_to_int(thread);
-
-	if (threadid < num_threads)
-		return clock[threadid];
-	else
-		return 0;
+modelclock_t ClockVector::getClock(thread_id_t thread) const {
+	return get(id_to_int(thread));
 }
 
 /** @brief Formats and prints this ClockVector's data. */
@@ -125,5 +293,5 @@ void ClockVector::print() const
 	int i;
 	model_print("(");
 	for (i = 0;i < num_threads;i++)
-		model_print("%2u%s", clock[i], (i == num_threads - 1) ? ")\n" : ", ");
+		model_print("%2u%s", get(i), (i == num_threads - 1) ? ")\n" : ", ");
 }
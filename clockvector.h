@@ -5,10 +5,17 @@
 #ifndef __CLOCKVECTOR_H__
 #define __CLOCKVECTOR_H__
 
+#include "config.h"
 #include "mymemory.h"
 #include "modeltypes.h"
 #include "classlist.h"
 
+/** @brief Heap storage for clocks, shared copy-on-write between vectors */
+struct ClockStore {
+	int refcount;
+	modelclock_t clock[];
+};
+
 class ClockVector {
 public:
 	ClockVector(ClockVector *parent = NULL, const ModelAction *act = NULL);
@@ -18,15 +25,35 @@ public:
 	bool synchronized_since(const ModelAction *act) const;
 
 	void print() const;
-	modelclock_t getClock(thread_id_t thread);
+	modelclock_t getClock(thread_id_t thread) const;
 
 	SNAPSHOTALLOC
 private:
-	/** @brief Holds the actual clock data, as an array. */
+	modelclock_t get(int threadid) const;
+	bool has_newer(const ClockVector *cv) const;
+	bool try_share(const ClockVector *cv, bool *changed);
+	void prepare_write(int new_threads);
+
+	/** @brief Holds the actual clock data, as an array.  Points to
+	 *  inline_clock until the vector outgrows it, then into store. */
 	modelclock_t *clock;
 
+	/** @brief Heap storage for clock; NULL while the clocks are inline */
+	ClockStore *store;
+
 	/** @brief The number of threads recorded in clock (i.e., its length).  */
 	int num_threads;
+
+	/** @brief Thread whose clock is own_clock rather than its entry in a
+	 *  shared store, or -1 if clock is exact */
+	int own;
+	modelclock_t own_clock;
+
+	modelclock_t inline_clock[CV_INLINE_THREADS];
+
+	/* Copying would alias inline_clock */
+	ClockVector(const ClockVector &);
+	ClockVector & operator=(const ClockVector &);
 };
 
 #endif	/* __CLOCKVECTOR_H__ */
@@ -112,6 +112,9 @@ void redirect_output()
  */
 static ssize_t read_to_buf(int fd, char *buf, size_t maxlen)
 {
+	/* The kernel cannot store into write-protected snapshot pages */
+	((volatile char *)buf)[0] = 0;
+	((volatile char *)buf)[maxlen - 1] = 0;
 	ssize_t ret = read(fd, buf, maxlen);
 	if (ret < 0) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
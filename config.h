@@ -37,16 +37,64 @@
 /** Page size configuration */
 #define PAGESIZE 4096
 
+/** Default memory, in megabytes, reserved for the model-checker's shared
+ *  (non-snapshotting) heap.  Only the pages it uses are committed. */
+#if BIT48
+#define SHARED_MEMORY_DEFAULT 4096
+#define SHARED_MEMORY_MAX (1 << 20)
+#else
+#define SHARED_MEMORY_DEFAULT 200
+#define SHARED_MEMORY_MAX 2048
+#endif
+
+/** Largest number of worker processes -j accepts */
+#define WORKERS_MAX 256
+
+/** Default and largest size, in megabytes, of the model-checker's own stack */
+#define STACK_SIZE_DEFAULT 20
+#define STACK_SIZE_MAX 1024
+
 #define TLS 1
 
 /** Thread parameters */
 
-/* Size of stack to allocate for a thread. */
+/* Default size of stack to allocate for a thread. */
 #define STACK_SIZE (1024 * 1024)
 
-/** How many shadow tables of memory to preallocate for data race detector. */
+/* Smallest and largest thread stack, in kilobytes, that -S accepts. */
+#define STACK_SIZE_MIN_KB 16
+#define STACK_SIZE_MAX_KB (1024 * 1024)
+
+/** Default number of shadow tables of memory to preallocate for data race
+ *  detector. */
 #define SHADOWBASETABLES 4
 
+/** Largest number of shadow tables -D accepts; each one is 512 KB of the
+ *  snapshotting heap. */
+#define SHADOWBASETABLES_MAX 1024
+
+/** Number of threads whose clocks a ClockVector stores inline before it
+ *  spills to the snapshotting heap. */
+#ifndef CV_INLINE_THREADS
+#define CV_INLINE_THREADS 8
+#endif
+
+/** Let CycleGraph mark the clock vectors downstream of a new mo edge as
+ *  stale and only recompute them when a reachability query needs them,
+ *  instead of propagating every change eagerly. */
+//#define LAZY_MO_CLOCKS
+
+/** Maximum share of the run time, in percent, that --gcmemory collections
+ *  may take before the heap growth allowed between them is raised. */
+#define GC_MAX_OVERHEAD 10
+
+/** Largest --gcmemory budget, in megabytes */
+#define GC_MEMORY_MAX (1 << 20)
+
+/** Number of most recent actions that --gcmemory collections keep when
+ *  --minsize is not given. */
+#define GC_MINSIZE_DEFAULT 10000
+
 /** Enable debugging assertions (via ASSERT()) */
 //#define CONFIG_ASSERT
 
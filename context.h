@@ -9,6 +9,20 @@
 #include <ucontext.h>
 #include <stdio.h>
 
+/**
+ * @brief Fault in the signal mask of a context before saving into it
+ *
+ * getcontext() and swapcontext() store the signal mask from the kernel,
+ * which fails instead of faulting if the page is write-protected by the
+ * mprotect snapshotting backend.
+ */
+static inline void model_prefault_context(ucontext_t *ucp)
+{
+	volatile char *mask = (volatile char *)&ucp->uc_sigmask;
+	mask[0] = mask[0];
+	mask[sizeof(unsigned long) - 1] = mask[sizeof(unsigned long) - 1];
+}
+
 #ifdef MAC
 
 int model_swapcontext(ucontext_t *oucp, ucontext_t *ucp);
@@ -17,6 +31,7 @@ int model_swapcontext(ucontext_t *oucp, ucontext_t *ucp);
 
 static inline int model_swapcontext(ucontext_t *oucp, ucontext_t *ucp)
 {
+	model_prefault_context(oucp);
 	return swapcontext(oucp, ucp);
 }
 
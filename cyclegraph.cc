@@ -13,6 +13,7 @@ CycleGraph::CycleGraph() :
 /** CycleGraph destructor */
 CycleGraph::~CycleGraph()
 {
+	partitions.resetanddelete();
 	delete queue;
 }
 
@@ -47,23 +48,31 @@ CycleNode * CycleGraph::getNode(ModelAction *action)
 {
 	CycleNode *node = getNode_noCreate(action);
 	if (node == NULL) {
-		node = new CycleNode(action);
+		const void *location = action->get_location();
+		CyclePartition *partition = partitions.get(location);
+		if (partition == NULL) {
+			partition = new CyclePartition();
+			partitions.put(location, partition);
+		}
+		node = partition->allocNode(action);
 		putNode(action, node);
 	}
 	return node;
 }
 
 /**
- * Adds an edge between two CycleNodes.
+ * Adds an edge between two CycleNodes and merges the clock vector of the
+ * source into tonode, without propagating it any further.
  * @param fromnode The edge comes from this CycleNode
  * @param tonode The edge points to this CycleNode
- * @return True, if new edge(s) are added; otherwise false
+ * @return True, if the clock vector of tonode changed and the change must
+ * be propagated to its successors; otherwise false
  */
-void CycleGraph::addNodeEdge(CycleNode *fromnode, CycleNode *tonode, bool forceedge)
+bool CycleGraph::linkNodes(CycleNode *fromnode, CycleNode *tonode, bool forceedge)
 {
 	//quick check whether edge is redundant
 	if (checkReachable(fromnode, tonode) && !forceedge) {
-		return;
+		return false;
 	}
 
 	/*
@@ -77,23 +86,100 @@ void CycleGraph::addNodeEdge(CycleNode *fromnode, CycleNode *tonode, bool forcee
 	}
 
 	fromnode->addEdge(tonode);	//Add edge to edgeSrcNode
+#ifdef LAZY_MO_CLOCKS
+	markStale(tonode);
+	return false;
+#else
+	return tonode->cv->merge(fromnode->cv);
+#endif
+}
 
-	/* Propagate clock vector changes */
-	if (tonode->cv->merge(fromnode->cv)) {
-		queue->push_back(tonode);
-		while(!queue->empty()) {
-			const CycleNode *node = queue->back();
-			queue->pop_back();
-			unsigned int numedges = node->getNumEdges();
-			for(unsigned int i = 0;i < numedges;i++) {
-				CycleNode * enode = node->getEdge(i);
-				if (enode->cv->merge(node->cv))
-					queue->push_back(enode);
+/**
+ * Adds an edge between two CycleNodes.
+ * @param fromnode The edge comes from this CycleNode
+ * @param tonode The edge points to this CycleNode
+ * @return True, if new edge(s) are added; otherwise false
+ */
+void CycleGraph::addNodeEdge(CycleNode *fromnode, CycleNode *tonode, bool forceedge)
+{
+	if (linkNodes(fromnode, tonode, forceedge))
+		propagate(tonode);
+}
+
+/** Pushes the clock vector of node, which just changed, to every node
+ *  reachable from it. */
+void CycleGraph::propagate(CycleNode *node)
+{
+	queue->push_back(node);
+	while(!queue->empty()) {
+		const CycleNode *node = queue->back();
+		queue->pop_back();
+		unsigned int numedges = node->getNumEdges();
+		for(unsigned int i = 0;i < numedges;i++) {
+			CycleNode * enode = node->getEdge(i);
+			if (enode != NULL && enode->cv->merge(node->cv))
+				queue->push_back(enode);
+		}
+	}
+}
+
+#ifdef LAZY_MO_CLOCKS
+/** Marks node and everything reachable from it as missing clock vector
+ *  updates.  Nodes reachable from a stale node are always stale, so the
+ *  walk stops at the first one. */
+void CycleGraph::markStale(CycleNode *node)
+{
+	if (node->stale)
+		return;
+	node->stale = true;
+	queue->push_back(node);
+	while(!queue->empty()) {
+		const CycleNode *node = queue->back();
+		queue->pop_back();
+		unsigned int numedges = node->getNumEdges();
+		for(unsigned int i = 0;i < numedges;i++) {
+			CycleNode * enode = node->getEdge(i);
+			if (enode != NULL && !enode->stale) {
+				enode->stale = true;
+				queue->push_back(enode);
 			}
 		}
 	}
 }
 
+/** Brings the clock vector of node up to date by merging in those of its
+ *  stale predecessors first, in topological order. */
+void CycleGraph::refresh(const CycleNode *node) const
+{
+	if (!node->stale)
+		return;
+	/* Depth-first over the stale in-edges; a node is merged once all of
+	 * its predecessors are up to date.  inedge_index tracks where each
+	 * node on the stack resumes. */
+	queue->push_back(node);
+	while(!queue->empty()) {
+		CycleNode *top = const_cast<CycleNode *>(queue->back());
+		if (!top->stale) {
+			/* Pushed twice and refreshed through the other path */
+			queue->pop_back();
+			continue;
+		}
+		if (top->inedge_index < top->getNumInEdges()) {
+			CycleNode *pred = top->getInEdge(top->inedge_index++);
+			if (pred != NULL && pred->stale && pred->inedge_index == 0)
+				queue->push_back(pred);
+			continue;
+		}
+		queue->pop_back();
+		for(unsigned int i = 0;i < top->getNumInEdges();i++)
+			if (CycleNode *pred = top->getInEdge(i))
+				top->cv->merge(pred->cv);
+		top->inedge_index = 0;
+		top->stale = false;
+	}
+}
+#endif
+
 /**
  * @brief Add an edge between a write and the RMW which reads from it
  *
@@ -127,12 +213,20 @@ void CycleGraph::addRMWEdge(ModelAction *from, ModelAction *rmw)
 	 */
 	for (unsigned int i = 0;i < fromnode->getNumEdges();i++) {
 		CycleNode *tonode = fromnode->getEdge(i);
+		if (tonode == NULL)
+			continue;
 		if (tonode != rmwnode) {
 			rmwnode->addEdge(tonode);
 		}
 		tonode->removeInEdge(fromnode);
 	}
 	fromnode->edges.clear();
+#ifdef LAZY_MO_CLOCKS
+	/* The moved edges now start at rmwnode */
+	for (unsigned int i = 0;i < rmwnode->getNumEdges();i++)
+		if (CycleNode *tonode = rmwnode->getEdge(i))
+			markStale(tonode);
+#endif
 
 	addNodeEdge(fromnode, rmwnode, true);
 }
@@ -161,10 +255,34 @@ endinnerloop:
 endouterloop:
 		;
 	}
+	CycleNode *tonode = getNode(to);
+	bool changed = false;
 	for(sllnode<ModelAction*> *it = edgeset->begin();it!=NULL;it=it->getNext()) {
 		ModelAction *from = it->getVal();
-		addEdge(from, to, from->get_tid() == to->get_tid());
+		if (linkNodes(getNode(from), tonode, from->get_tid() == to->get_tid()))
+			changed = true;
+	}
+	/* One pass pushes the combined change downstream */
+	if (changed)
+		propagate(tonode);
+}
+
+/**
+ * @brief Adds edges from each action in edgeset to the action to
+ *
+ * Like adding the edges one at a time, but the clock vector changes are
+ * propagated from to once, after all of them were added.
+ */
+void CycleGraph::addEdges(SnapVector<ModelAction *> * edgeset, ModelAction *to)
+{
+	CycleNode *tonode = getNode(to);
+	bool changed = false;
+	for(unsigned int i = 0;i < edgeset->size();i++) {
+		if (linkNodes(getNode((*edgeset)[i]), tonode, false))
+			changed = true;
 	}
+	if (changed)
+		propagate(tonode);
 }
 
 /**
@@ -246,7 +364,8 @@ void CycleGraph::dumpNodes(FILE *file) const
 		if (n->getRMW())
 			print_edge(file, n, n->getRMW(), "style=dotted");
 		for (unsigned int j = 0;j < n->getNumEdges();j++)
-			print_edge(file, n, n->getEdge(j), NULL);
+			if (n->getEdge(j) != NULL)
+				print_edge(file, n, n->getEdge(j), NULL);
 	}
 }
 
@@ -270,7 +389,16 @@ void CycleGraph::dumpGraphToFile(const char *filename) const
  */
 bool CycleGraph::checkReachable(const CycleNode *from, const CycleNode *to) const
 {
-	return to->cv->synchronized_since(from->action);
+	if (to->cv->synchronized_since(from->action))
+		return true;
+#ifdef LAZY_MO_CLOCKS
+	/* A stale clock vector may only be missing edges */
+	if (to->stale) {
+		refresh(to);
+		return to->cv->synchronized_since(from->action);
+	}
+#endif
+	return false;
 }
 
 /**
@@ -290,27 +418,136 @@ bool CycleGraph::checkReachable(const ModelAction *from, const ModelAction *to)
 	return checkReachable(fromnode, tonode);
 }
 
+/**
+ * Removes the node of a freed action.  Its neighbours still list its index;
+ * those edges are skipped and dropped lazily (see CycleNode::getEdge), so
+ * freeing does not scan the neighbours' edge lists.
+ */
 void CycleGraph::freeAction(const ModelAction * act) {
 	CycleNode *cn = actionToNode.remove(act);
-	for(unsigned int i=0;i<cn->edges.size();i++) {
-		CycleNode *dst = cn->edges[i];
-		dst->removeInEdge(cn);
+#ifdef LAZY_MO_CLOCKS
+	/* Paths through cn disappear with it, so its successors must have
+	 * their clock vectors up to date first */
+	for(unsigned int i=0;i<cn->getNumEdges();i++)
+		if (CycleNode *dst = cn->getEdge(i))
+			refresh(dst);
+#endif
+
+	CyclePartition *partition = cn->partition;
+	partition->freeNode(cn);
+	if (partition->isEmpty()) {
+		/* Drop the location's whole arena */
+		partitions.remove(act->get_location());
+		delete partition;
 	}
-	for(unsigned int i=0;i<cn->inedges.size();i++) {
-		CycleNode *src = cn->inedges[i];
-		src->removeEdge(cn);
+}
+
+/** Initializes an empty CyclePartition. */
+CyclePartition::CyclePartition() :
+	chunks(),
+	chunklive(),
+	firstchunk(0),
+	used(0),
+	live(0)
+{
+}
+
+/** Destroys the remaining nodes and releases the chunks at once. */
+CyclePartition::~CyclePartition()
+{
+	for (unsigned int i = firstchunk << CP_CHUNKBITS;i < used;i++) {
+		if (isLive(i))
+			getNode(i)->~CycleNode();
 	}
-	delete cn;
+	for (unsigned int i = 0;i < chunks.size();i++)
+		if (chunks[i] != NULL)
+			snapshot_free(chunks[i]);
+}
+
+/**
+ * @return A new node for act.  Slots are handed out in order and never
+ * reused, so an index held by a neighbour cannot come to name another node.
+ */
+CycleNode * CyclePartition::allocNode(ModelAction *act)
+{
+	unsigned int index = used++;
+	if ((index & CP_CHUNKMASK) == 0) {
+		chunks.push_back((CycleNode *)snapshot_malloc(CP_CHUNKSIZE * sizeof(CycleNode)));
+		chunklive.push_back(0);
+	}
+	chunklive[(index >> CP_CHUNKBITS) - firstchunk]++;
+	live++;
+	return new (getNode(index)) CycleNode(act, this, index);
+}
+
+/**
+ * Destroys node.  Once every slot of its chunk was handed out and freed,
+ * the chunk itself is released; actions are freed oldest first, so this
+ * drops the nodes behind the collection frontier a chunk at a time.
+ */
+void CyclePartition::freeNode(CycleNode *node)
+{
+	unsigned int chunk = node->index >> CP_CHUNKBITS;
+	node->~CycleNode();
+	/* Marks the slot dead for isLive */
+	node->action = NULL;
+	if (--live == 0) {
+		/* No neighbour holds an index any more, so numbering starts over */
+		for (unsigned int i = 0;i < chunks.size();i++)
+			if (chunks[i] != NULL)
+				snapshot_free(chunks[i]);
+		chunks.clear();
+		chunklive.clear();
+		firstchunk = 0;
+		used = 0;
+		return;
+	}
+	if (--chunklive[chunk - firstchunk] == 0 && used >= (chunk + 1) * CP_CHUNKSIZE) {
+		snapshot_free(chunks[chunk - firstchunk]);
+		chunks[chunk - firstchunk] = NULL;
+		if (chunk == firstchunk)
+			dropFreedChunks();
+	}
+}
+
+/**
+ * Drops the released chunks at the front of the chunk table, once they
+ * make up at least half of it, so the table follows the live nodes rather
+ * than every node the partition ever had.
+ */
+void CyclePartition::dropFreedChunks()
+{
+	unsigned int freed = 0;
+	while (freed < chunks.size() && chunks[freed] == NULL)
+		freed++;
+	if (freed * 2 < chunks.size())
+		return;
+	unsigned int kept = chunks.size() - freed;
+	for (unsigned int i = 0;i < kept;i++) {
+		chunks[i] = chunks[i + freed];
+		chunklive[i] = chunklive[i + freed];
+	}
+	chunks.resize(kept);
+	chunklive.resize(kept);
+	firstchunk += freed;
 }
 
 /**
  * @brief Constructor for a CycleNode
  * @param act The ModelAction for this node
  */
-CycleNode::CycleNode(ModelAction *act) :
+CycleNode::CycleNode(ModelAction *act, CyclePartition *partition, unsigned int index) :
 	action(act),
+	partition(partition),
+	index(index),
+	edges(),
+	inedges(),
 	hasRMW(NULL),
 	cv(new ClockVector(NULL, act))
+#ifdef LAZY_MO_CLOCKS
+	, stale(false),
+	inedge_index(0)
+#endif
 {
 }
 
@@ -318,9 +555,19 @@ CycleNode::~CycleNode() {
 	delete cv;
 }
 
+/** Drops the indices of freed nodes from list. */
+void CycleNode::pruneEdges(SnapVector<unsigned int> *list) {
+	unsigned int to = 0;
+	for(unsigned int i=0;i < list->size();i++) {
+		if (partition->isLive((*list)[i]))
+			(*list)[to++] = (*list)[i];
+	}
+	list->resize(to);
+}
+
 void CycleNode::removeInEdge(CycleNode *src) {
 	for(unsigned int i=0;i < inedges.size();i++) {
-		if (inedges[i] == src) {
+		if (inedges[i] == src->index) {
 			inedges[i] = inedges[inedges.size()-1];
 			inedges.pop_back();
 			break;
@@ -328,23 +575,13 @@ void CycleNode::removeInEdge(CycleNode *src) {
 	}
 }
 
-void CycleNode::removeEdge(CycleNode *dst) {
-	for(unsigned int i=0;i < edges.size();i++) {
-		if (edges[i] == dst) {
-			edges[i] = edges[edges.size()-1];
-			edges.pop_back();
-			break;
-		}
-	}
-}
-
 /**
  * @param i The index of the edge to return
- * @returns The CycleNode edge indexed by i
+ * @returns The CycleNode edge indexed by i, or NULL if that node was freed
  */
 CycleNode * CycleNode::getEdge(unsigned int i) const
 {
-	return edges[i];
+	return partition->getLiveNode(edges[i]);
 }
 
 /** @returns The number of edges leaving this CycleNode */
@@ -355,11 +592,11 @@ unsigned int CycleNode::getNumEdges() const
 
 /**
  * @param i The index of the edge to return
- * @returns The CycleNode edge indexed by i
+ * @returns The CycleNode edge indexed by i, or NULL if that node was freed
  */
 CycleNode * CycleNode::getInEdge(unsigned int i) const
 {
-	return inedges[i];
+	return partition->getLiveNode(inedges[i]);
 }
 
 /** @returns The number of edges leaving this CycleNode */
@@ -375,11 +612,24 @@ unsigned int CycleNode::getNumInEdges() const
  */
 void CycleNode::addEdge(CycleNode *node)
 {
-	for (unsigned int i = 0;i < edges.size();i++)
-		if (edges[i] == node)
+	/* mo edges never leave a location */
+	ASSERT(node->partition == partition);
+	unsigned int to = 0;
+	for (unsigned int i = 0;i < edges.size();i++) {
+		if (edges[i] == node->index)
 			return;
-	edges.push_back(node);
-	node->inedges.push_back(this);
+		/* Drop edges to freed nodes while scanning anyway */
+		if (partition->isLive(edges[i]))
+			edges[to++] = edges[i];
+	}
+	edges.resize(to);
+	edges.push_back(node->index);
+	/* In-edge lists are only appended to; prune them whenever their size
+	 * reaches a power of two, which keeps the cost amortized constant */
+	unsigned int numin = node->inedges.size();
+	if (numin >= CP_CHUNKSIZE && (numin & (numin - 1)) == 0)
+		node->pruneEdges(&node->inedges);
+	node->inedges.push_back(index);
 }
 
 /** @returns the RMW CycleNode that reads from the current CycleNode */
@@ -24,6 +24,7 @@ public:
 	CycleGraph();
 	~CycleGraph();
 	void addEdges(SnapList<ModelAction *> * edgeset, ModelAction *to);
+	void addEdges(SnapVector<ModelAction *> * edgeset, ModelAction *to);
 	void addEdge(ModelAction *from, ModelAction *to);
 	void addEdge(ModelAction *from, ModelAction *to, bool forceedge);
 	void addRMWEdge(ModelAction *from, ModelAction *rmw);
@@ -39,12 +40,20 @@ public:
 	CycleNode * getNode_noCreate(const ModelAction *act) const;
 	SNAPSHOTALLOC
 private:
+	bool linkNodes(CycleNode *fromnode, CycleNode *tonode, bool forceedge);
 	void addNodeEdge(CycleNode *fromnode, CycleNode *tonode, bool forceedge);
+	void propagate(CycleNode *node);
+#ifdef LAZY_MO_CLOCKS
+	void markStale(CycleNode *node);
+	void refresh(const CycleNode *node) const;
+#endif
 	void putNode(const ModelAction *act, CycleNode *node);
 	CycleNode * getNode(ModelAction *act);
 
 	/** @brief A table for mapping ModelActions to CycleNodes */
 	HashTable<const ModelAction *, CycleNode *, uintptr_t, 4> actionToNode;
+	/** @brief The subgraph of each memory location */
+	HashTable<const void *, CyclePartition *, uintptr_t, 2> partitions;
 	SnapVector<const CycleNode *> * queue;
 
 #if SUPPORT_MOD_ORDER_DUMP
@@ -59,7 +68,7 @@ private:
  */
 class CycleNode {
 public:
-	CycleNode(ModelAction *act);
+	CycleNode(ModelAction *act, CyclePartition *partition, unsigned int index);
 	void addEdge(CycleNode *node);
 	CycleNode * getEdge(unsigned int i) const;
 	unsigned int getNumEdges() const;
@@ -70,19 +79,26 @@ public:
 	void clearRMW() { hasRMW = NULL; }
 	ModelAction * getAction() const { return action; }
 	void removeInEdge(CycleNode *src);
-	void removeEdge(CycleNode *dst);
 	~CycleNode();
 
 	SNAPSHOTALLOC
 private:
+	void pruneEdges(SnapVector<unsigned int> *list);
+
 	/** @brief The ModelAction that this node represents */
 	ModelAction *action;
 
-	/** @brief The edges leading out from this node */
-	SnapVector<CycleNode *> edges;
+	/** @brief The partition holding this node and its neighbours */
+	CyclePartition *partition;
+
+	/** @brief This node's index in partition */
+	unsigned int index;
+
+	/** @brief The edges leading out from this node, as partition indices */
+	SnapVector<unsigned int> edges;
 
-	/** @brief The edges leading in from this node */
-	SnapVector<CycleNode *> inedges;
+	/** @brief The edges leading in from this node, as partition indices */
+	SnapVector<unsigned int> inedges;
 
 	/** Pointer to a RMW node that reads from this node, or NULL, if none
 	 * exists */
@@ -90,7 +106,73 @@ private:
 
 	/** ClockVector for this Node. */
 	ClockVector *cv;
+#ifdef LAZY_MO_CLOCKS
+	/** @brief Whether cv is missing updates from its predecessors */
+	bool stale;
+	/** @brief Next in-edge to visit while refreshing cv */
+	unsigned int inedge_index;
+#endif
 	friend class CycleGraph;
+	friend class CyclePartition;
+};
+
+/** @brief log2 of the number of CycleNodes in a CyclePartition chunk */
+#define CP_CHUNKBITS 6
+#define CP_CHUNKSIZE (1 << CP_CHUNKBITS)
+#define CP_CHUNKMASK (CP_CHUNKSIZE - 1)
+
+/**
+ * @brief The nodes of the mo graph for one memory location
+ *
+ * Modification order only relates writes to the same location, so each
+ * location's nodes form a separate subgraph.  A partition stores them in
+ * chunks of CP_CHUNKSIZE nodes, so a node's address is stable and nodes
+ * can refer to their neighbours by index.  Slots are handed out in order
+ * and never reused; a chunk is released once every one of its slots was
+ * handed out and freed, and the chunk table drops released chunks from its
+ * front.  The whole partition is released at once when its last node is
+ * freed.
+ */
+class CyclePartition {
+public:
+	CyclePartition();
+	~CyclePartition();
+	CycleNode * allocNode(ModelAction *act);
+	void freeNode(CycleNode *node);
+	/** @return The node with the given index */
+	CycleNode * getNode(unsigned int index) const {
+		return &chunks[(index >> CP_CHUNKBITS) - firstchunk][index & CP_CHUNKMASK];
+	}
+	/** @return Whether the node with the given index was not freed */
+	bool isLive(unsigned int index) const {
+		unsigned int chunk = index >> CP_CHUNKBITS;
+		if (chunk < firstchunk)
+			return false;
+		CycleNode *nodes = chunks[chunk - firstchunk];
+		return nodes != NULL && nodes[index & CP_CHUNKMASK].action != NULL;
+	}
+	/** @return The node with the given index, or NULL if it was freed */
+	CycleNode * getLiveNode(unsigned int index) const {
+		return isLive(index) ? getNode(index) : NULL;
+	}
+	bool isEmpty() const { return live == 0; }
+
+	SNAPSHOTALLOC
+private:
+	void dropFreedChunks();
+
+	/** @brief The chunks of nodes, starting with chunk firstchunk; NULL
+	 *  once all of a chunk's nodes were freed */
+	SnapVector<CycleNode *> chunks;
+	/** @brief Number of live nodes in each entry of chunks */
+	SnapVector<unsigned int> chunklive;
+	/** @brief Number of the chunk that chunks starts with; every chunk
+	 *  before it was released */
+	unsigned int firstchunk;
+	/** @brief Number of slots handed out so far */
+	unsigned int used;
+	/** @brief Number of live nodes */
+	unsigned int live;
 };
 
 #endif	/* __CYCLEGRAPH_H__ */
@@ -13,11 +13,36 @@
 #include "relationsgraph.h"
 
 static struct ShadowTable *root;
+static struct ClockOwnerTable **clockowners;
 static void *memory_base;
 static void *memory_top;
 static RaceSet * raceset;
+static RaceKeySet * racekeys;
+static RaceSiteTable * racesites;
+static unsigned int maxraces;
+static unsigned int sitebudget;
+static unsigned int racesample;
+static uint64_t samplestate;
+
+/** Read vector clocks come in power of two size classes of
+ * (1 << MINREADCLASS) to (1 << (MINREADCLASS + NUMREADCLASSES - 1)) entries;
+ * larger ones bypass the pool. */
+#define MINREADCLASS 2
+#define NUMREADCLASSES 12
+#define POOLCHUNKSIZE (64 * 1024)
+
+static char *pool_base;
+static char *pool_top;
+static struct RaceRecord *free_records;
+static modelclock_t *free_readclocks[NUMREADCLASSES];
 
 #ifdef COLLECT_STAT
+static unsigned int records_inuse = 0;
+static unsigned int records_allocated = 0;
+static unsigned int readclocks_inuse[NUMREADCLASSES];
+static unsigned int readclocks_allocated[NUMREADCLASSES];
+static unsigned int readclocks_large = 0;
+
 static unsigned int store8_count = 0;
 static unsigned int store16_count = 0;
 static unsigned int store32_count = 0;
@@ -35,12 +60,18 @@ static ModelExecution * get_execution()
 }
 
 /** This function initialized the data race detector. */
-void initRaceDetector()
+void initRaceDetector(struct model_params *params)
 {
 	root = (struct ShadowTable *)snapshot_calloc(sizeof(struct ShadowTable), 1);
-	memory_base = snapshot_calloc(sizeof(struct ShadowBaseTable) * SHADOWBASETABLES, 1);
-	memory_top = ((char *)memory_base) + sizeof(struct ShadowBaseTable) * SHADOWBASETABLES;
+	memory_base = snapshot_calloc(sizeof(struct ShadowBaseTable) * params->shadowtables, 1);
+	memory_top = ((char *)memory_base) + sizeof(struct ShadowBaseTable) * params->shadowtables;
+	clockowners = (struct ClockOwnerTable **)snapshot_calloc(sizeof(struct ClockOwnerTable *), (MAXWRITEVECTOR >> 16) + 1);
 	raceset = new RaceSet();
+	racekeys = new RaceKeySet();
+	racesites = new RaceSiteTable();
+	maxraces = params->maxraces;
+	sitebudget = params->sitebudget;
+	racesample = params->racesample;
 }
 
 void * table_calloc(size_t size)
@@ -54,6 +85,105 @@ void * table_calloc(size_t size)
 	}
 }
 
+/** This function carves a block out of the race record pool.  Blocks are
+ * never returned to the snapshotting heap; rollback reclaims them. */
+static void * pool_alloc(size_t size)
+{
+	if (pool_base + size > pool_top) {
+		pool_base = (char *)snapshot_malloc(POOLCHUNKSIZE);
+		pool_top = pool_base + POOLCHUNKSIZE;
+	}
+	void *tmp = pool_base;
+	pool_base += size;
+	return tmp;
+}
+
+/** This function allocates a zeroed race record from the pool. */
+static struct RaceRecord * allocRaceRecord()
+{
+	struct RaceRecord *record = free_records;
+	if (record != NULL) {
+		free_records = record->nextFree;
+	} else {
+		record = (struct RaceRecord *)pool_alloc(sizeof(struct RaceRecord));
+#ifdef COLLECT_STAT
+		records_allocated++;
+#endif
+	}
+#ifdef COLLECT_STAT
+	records_inuse++;
+#endif
+	real_memset(record, 0, sizeof(struct RaceRecord));
+	return record;
+}
+
+/** Returns the size class for a read vector clock of capacity entries, or
+ * NUMREADCLASSES if it is too large for the pool. */
+static inline int readClockClass(int capacity)
+{
+	int cls = 0;
+	while (cls < NUMREADCLASSES && (1 << (cls + MINREADCLASS)) < capacity)
+		cls++;
+	return cls;
+}
+
+/** This function allocates an uninitialized read vector clock with at least
+ * *capacity entries and updates *capacity to its actual size. */
+static modelclock_t * allocReadClock(int *capacity)
+{
+	int cls = readClockClass(*capacity);
+	if (cls == NUMREADCLASSES) {
+#ifdef COLLECT_STAT
+		readclocks_large++;
+#endif
+		return (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * (*capacity));
+	}
+	*capacity = 1 << (cls + MINREADCLASS);
+	modelclock_t *clock = free_readclocks[cls];
+	if (clock != NULL) {
+		free_readclocks[cls] = *(modelclock_t **)clock;
+	} else {
+		clock = (modelclock_t *)pool_alloc(sizeof(modelclock_t) * (*capacity));
+#ifdef COLLECT_STAT
+		readclocks_allocated[cls]++;
+#endif
+	}
+#ifdef COLLECT_STAT
+	readclocks_inuse[cls]++;
+#endif
+	return clock;
+}
+
+/** Returns a read vector clock to its size class. */
+static void freeReadClock(modelclock_t *clock, int capacity)
+{
+	int cls = readClockClass(capacity);
+	if (cls == NUMREADCLASSES) {
+#ifdef COLLECT_STAT
+		readclocks_large--;
+#endif
+		snapshot_free(clock);
+		return;
+	}
+	*(modelclock_t **)clock = free_readclocks[cls];
+	free_readclocks[cls] = clock;
+#ifdef COLLECT_STAT
+	readclocks_inuse[cls]--;
+#endif
+}
+
+/** Returns a race record and its read vector clock to the pool. */
+static void freeRaceRecord(struct RaceRecord *record)
+{
+	if (record->readCapacity != 0)
+		freeReadClock(record->readClock, record->readCapacity);
+	record->nextFree = free_records;
+	free_records = record;
+#ifdef COLLECT_STAT
+	records_inuse--;
+#endif
+}
+
 /** This function looks up the entry in the shadow table corresponding to a
  * given address.*/
 static inline uint64_t * lookupAddressEntry(const void *address)
@@ -74,6 +204,28 @@ static inline uint64_t * lookupAddressEntry(const void *address)
 }
 
 
+/** This function records which thread performed the action with a given
+ * sequence number, so that compact shadow records only need to store clocks.
+ * Clocks that do not fit in the compact encoding are never looked up. */
+void recordClockOwner(modelclock_t clock, thread_id_t thread)
+{
+	if (clock > MAXWRITEVECTOR)
+		return;
+	struct ClockOwnerTable *table = clockowners[clock >> 16];
+	if (table == NULL)
+		table = clockowners[clock >> 16] = (struct ClockOwnerTable *)snapshot_calloc(1, sizeof(struct ClockOwnerTable));
+	table->array[clock & MASK16BIT] = thread;
+}
+
+/** This function looks up the thread that owns a clock from a compact shadow
+ * record.  A zero clock means no access and maps to the initial thread. */
+static inline thread_id_t clockOwner(modelclock_t clock)
+{
+	if (clock == 0)
+		return 0;
+	return clockowners[clock >> 16]->array[clock & MASK16BIT];
+}
+
 bool hasNonAtomicStore(const void *address) {
 	uint64_t * shadow = lookupAddressEntry(address);
 	uint64_t shadowval = *shadow;
@@ -95,7 +247,7 @@ void setAtomicStoreFlag(const void *address) {
 		*shadow = shadowval | ATOMICMASK;
 	} else {
 		if (shadowval == 0) {
-			*shadow = ATOMICMASK | ENCODEOP(0, 0, 0, 0);
+			*shadow = ATOMICMASK | ENCODEOP(0, 0);
 			return;
 		}
 		struct RaceRecord *record = (struct RaceRecord *)shadowval;
@@ -108,8 +260,8 @@ void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelcloc
 	uint64_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval) || shadowval == 0) {
 		//Do we have a non atomic write with a non-zero clock
-		*thread = WRTHREADID(shadowval);
 		*clock = WRITEVECTOR(shadowval);
+		*thread = clockOwner(*clock);
 	} else {
 		struct RaceRecord *record = (struct RaceRecord *)shadowval;
 		*thread = record->writeThread;
@@ -141,29 +293,90 @@ static void expandRecord(uint64_t *shadow)
 	uint64_t shadowval = *shadow;
 
 	modelclock_t readClock = READVECTOR(shadowval);
-	thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+	thread_id_t readThread = clockOwner(readClock);
 	modelclock_t writeClock = WRITEVECTOR(shadowval);
-	thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+	thread_id_t writeThread = clockOwner(writeClock);
 
-	struct RaceRecord *record = (struct RaceRecord *)snapshot_calloc(1, sizeof(struct RaceRecord));
+	struct RaceRecord *record = allocRaceRecord();
 	record->writeThread = writeThread;
 	record->writeClock = writeClock;
+	record->readThread = readThread;
+	record->readEpoch = readClock;
 
-	if (readClock != 0) {
-		record->thread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * INITCAPACITY);
-		record->readClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * INITCAPACITY);
-		record->numReads = 1;
-		ASSERT(readThread >= 0);
-		record->thread[0] = readThread;
-		record->readClock[0] = readClock;
-	} else {
-		record->thread = NULL;
-	}
 	if (shadowval & ATOMICMASK)
 		record->isAtomic = 1;
 	*shadow = (uint64_t) record;
 }
 
+/** Makes sure the read vector clock of a record has an entry for threadid. */
+static void ensureReadCapacity(struct RaceRecord *record, int threadid)
+{
+	if (threadid < record->readCapacity)
+		return;
+	int newCapacity = get_execution()->get_num_threads();
+	if (newCapacity <= threadid)
+		newCapacity = threadid + 1;
+	modelclock_t *newClock = allocReadClock(&newCapacity);
+	if (record->readCapacity != 0) {
+		real_memcpy(newClock, record->readClock, sizeof(modelclock_t) * record->readCapacity);
+		freeReadClock(record->readClock, record->readCapacity);
+	}
+	real_memset(&newClock[record->readCapacity], 0, sizeof(modelclock_t) * (newCapacity - record->readCapacity));
+	record->readClock = newClock;
+	record->readCapacity = newCapacity;
+}
+
+/**
+ * Records a read in an expanded record.  While reads are totally ordered we
+ * just replace the read epoch; a read that is concurrent with the last one
+ * inflates the record to a read vector clock.
+ */
+static void fullRecordRead(thread_id_t thread, struct RaceRecord *record, ClockVector *currClock)
+{
+	modelclock_t ourClock = currClock->getClock(thread);
+	int threadid = id_to_int(thread);
+
+	if (record->readShared) {
+		ensureReadCapacity(record, threadid);
+		record->readClock[threadid] = ourClock;
+		return;
+	}
+
+	/*  Note that is not really a datarace check as reads cannot actually
+	    race.  It is just determining that this read subsumes the last one
+	    in the sense that either this read races or neither read races. */
+	if (!clock_may_race(currClock, thread, record->readEpoch, record->readThread)) {
+		record->readThread = thread;
+		record->readEpoch = ourClock;
+		return;
+	}
+
+	/* Concurrent reads: inflate to a read vector clock */
+	int readThreadid = id_to_int(record->readThread);
+	ensureReadCapacity(record, threadid > readThreadid ? threadid : readThreadid);
+	real_memset(record->readClock, 0, sizeof(modelclock_t) * record->readCapacity);
+	record->readClock[readThreadid] = record->readEpoch;
+	record->readClock[threadid] = ourClock;
+	record->readShared = 1;
+}
+
+/** Forgets all reads of an expanded record, deflating it back to an epoch. */
+static inline void clearFullRecordReads(struct RaceRecord *record)
+{
+	record->readShared = 0;
+	record->readEpoch = 0;
+}
+
+/** Collapses an expanded record whose reads have been cleared back to the
+ * compact form and returns it to the pool. */
+static inline void compactRecord(uint64_t *shadow, struct RaceRecord *record)
+{
+	if (record->writeClock > MAXWRITEVECTOR)
+		return;
+	*shadow = ENCODEOP(0, record->writeClock) | (record->isAtomic ? ATOMICMASK : 0);
+	freeRaceRecord(record);
+}
+
 #define FIRST_STACK_FRAME 2
 
 unsigned int race_hash(struct DataRace *race) {
@@ -185,10 +398,38 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2) {
 	return true;
 }
 
+/** Returns true once the run has reported as many unique races as the
+ * race budget allows. */
+static inline bool raceBudgetExhausted()
+{
+	if (maxraces == 0)
+		return false;
+	if (worker_shared != NULL)
+		return worker_shared->numraces >= maxraces;
+	return raceset->getSize() >= maxraces;
+}
+
+/** Decides whether a plain load is race checked under the sampling rate and
+ * race budget.  Stores are always checked, as their shadow words also tell
+ * atomic loads about earlier non-atomic stores. */
+static inline bool sampleRead()
+{
+	if (raceBudgetExhausted())
+		return false;
+	if (racesample >= 100)
+		return true;
+	if (samplestate == 0)
+		samplestate = ((uint64_t)model->get_execution_number() << 1) | 1;
+	samplestate = samplestate * 6364136223846793005ULL + 1442695040888963407ULL;
+	return ((samplestate >> 33) % 100) < racesample;
+}
+
 /** This function is called when we detect a data race.*/
 static struct DataRace * reportDataRace(thread_id_t oldthread, modelclock_t oldclock, bool isoldwrite, ModelAction *newaction, bool isnewwrite, const void *address)
 {
 #ifdef REPORT_DATA_RACES
+	if (raceBudgetExhausted())
+		return NULL;
 	struct DataRace *race = (struct DataRace *)model_malloc(sizeof(struct DataRace));
 	race->oldthread = oldthread;
 	race->oldclock = oldclock;
@@ -228,12 +469,8 @@ void assert_race(struct DataRace *race)
 
 	auto exe = get_execution();
 	// auto old_thread = exe->get_thread(race->oldthread);
-	ModelAction *action1 = nullptr;
-	for (auto a = exe->get_action_trace()->begin(); a != nullptr; a = a->getNext()) {
-		if (a->getVal()->get_seq_number() == race->oldclock) {
-			action1 = a->getVal();
-		}
-	}
+	auto node1 = exe->get_action_trace()->find(race->oldclock);
+	ModelAction *action1 = node1 != nullptr ? node1->getVal() : nullptr;
 	ASSERT(action1 != nullptr);
 	
 	auto action2 = race->newaction;
@@ -262,28 +499,172 @@ void assert_race(struct DataRace *race)
 	exe->relations_graph.pretty_print();
 }
 
-/** This function does race detection for a write on an expanded record. */
-struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+/** With parallel workers, claims the report of a race for this worker.
+ * Returns false if another worker already reported the race. */
+static bool claimWorkerRace(struct DataRace *race)
 {
-	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
-	struct DataRace * race = NULL;
+	if (worker_shared == NULL)
+		return true;
+	uint64_t hash = 0;
+	for(int i = FIRST_STACK_FRAME;i < race->numframes;i++)
+		hash = (hash ^ (uintptr_t)race->backtrace[i]) * 0x9e3779b97f4a7c15ULL;
+	hash |= 1;
+	for(unsigned int i = 0;i < WORKER_RACESLOTS;i++) {
+		uint64_t old = __sync_val_compare_and_swap(&worker_shared->races[(hash + i) % WORKER_RACESLOTS], 0, hash);
+		if (old == 0)
+			return true;
+		if (old == hash)
+			return false;
+	}
+	return true;
+}
 
-	/* Check for datarace against last read. */
+/** With parallel workers, counts a race against the race budget shared by
+ * all workers.  Returns false if the budget is used up. */
+static bool claimRaceBudget()
+{
+	if (maxraces == 0 || worker_shared == NULL)
+		return true;
+	return __sync_fetch_and_add(&worker_shared->numraces, 1) < maxraces;
+}
 
-	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
+/** Finds the slot of an access site in worker_shared, claiming a free one
+ * for it if needed.  Returns -1 if the table is full. */
+static int findWorkerSite(uint64_t site)
+{
+	site |= 1;
+	for(unsigned int i = 0;i < WORKER_RACESLOTS;i++) {
+		unsigned int slot = (site + i) % WORKER_RACESLOTS;
+		uint64_t old = __sync_val_compare_and_swap(&worker_shared->sites[slot], 0, site);
+		if (old == 0 || old == site)
+			return slot;
+	}
+	return -1;
+}
 
-		/* Note that readClock can't actuall be zero here, so it could be
-		         optimized. */
+/** Returns the number of races counted at an access site.  Parallel workers
+ * count in worker_shared, so the site budget covers all of them. */
+static unsigned int siteReports(uintptr_t site)
+{
+	if (worker_shared == NULL)
+		return racesites->get(site);
+	int slot = findWorkerSite(site);
+	return slot < 0 ? 0 : worker_shared->sitecounts[slot];
+}
 
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
-			/* We have a datarace */
-			race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
-			goto Exit;
+/** Counts a race at an access site against the site budget.  Returns false
+ * if the budget of the site is used up. */
+static bool claimSiteBudget(uintptr_t site)
+{
+	if (worker_shared == NULL) {
+		unsigned int count = racesites->get(site);
+		if (count >= sitebudget)
+			return false;
+		racesites->put(site, count + 1);
+		return true;
+	}
+	int slot = findWorkerSite(site);
+	if (slot < 0)
+		return true;
+	return __sync_fetch_and_add(&worker_shared->sitecounts[slot], 1) < sitebudget;
+}
+
+/** Number of innermost frames that make up the access site of a race, for
+ * the report budget.  This reaches past the race detector and the
+ * instrumentation entry point to the racing access in the program. */
+#define RACE_SITE_FRAMES 5
+
+/** Number of innermost frames hashed into the pre-deduplication key of a
+ * race: the access site and a few of its callers. */
+#define RACE_KEY_FRAMES 8
+
+/**
+ * This function deduplicates a detected race.  Races are first checked
+ * against a cheap key made from the racing address and the innermost stack
+ * frames, so the full backtrace is only unwound the first time a racing
+ * access site hits an address.  Keys are only added for reported races, so
+ * there is at most one per entry of raceset.  Sites that used up their
+ * report budget are dropped before the unwind as well.
+ */
+static void processDataRace(struct DataRace *race)
+{
+#ifdef REPORT_DATA_RACES
+	void *frames[RACE_KEY_FRAMES];
+	int numframes = backtrace(frames, RACE_KEY_FRAMES);
+	uintptr_t site = 0, key;
+	int i;
+	for(i = FIRST_STACK_FRAME;i < numframes && i < RACE_SITE_FRAMES;i++)
+		site = (site ^ (uintptr_t)frames[i]) * 0x9e3779b97f4a7c15ULL;
+	for(key = site;i < numframes;i++)
+		key = (key ^ (uintptr_t)frames[i]) * 0x9e3779b97f4a7c15ULL;
+	key = (key ^ (uintptr_t)race->address) * 0x9e3779b97f4a7c15ULL;
+	key ^= key >> 32;
+	if (racekeys->contains(key)) {
+		model_free(race);
+		return;
+	}
+
+	/* Skip the unwind once the site used up its report budget */
+	if (sitebudget != 0) {
+		site ^= site >> 32;
+		if (siteReports(site) >= sitebudget) {
+			model_free(race);
+			return;
 		}
 	}
 
+	race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
+	if (raceset->contains(race)) {
+		model_free(race);
+		return;
+	}
+	if (claimWorkerRace(race)) {
+		if ((sitebudget != 0 && !claimSiteBudget(site)) || !claimRaceBudget()) {
+			model_free(race);
+			return;
+		}
+		assert_race(race);
+	}
+	raceset->add(race);
+	racekeys->add(key);
+#else
+	model_free(race);
+#endif
+}
+
+/** This function checks the reads of an expanded record against a write. */
+static struct DataRace * fullRaceCheckReads(thread_id_t thread, const void *location, struct RaceRecord *record, ClockVector *currClock)
+{
+	if (!record->readShared) {
+		modelclock_t readClock = record->readEpoch;
+		thread_id_t readThread = record->readThread;
+
+		if (clock_may_race(currClock, thread, readClock, readThread))
+			return reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
+		return NULL;
+	}
+
+	for (int i = 0;i < record->readCapacity;i++) {
+		modelclock_t readClock = record->readClock[i];
+		thread_id_t readThread = int_to_id(i);
+
+		if (clock_may_race(currClock, thread, readClock, readThread))
+			return reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
+	}
+	return NULL;
+}
+
+/** This function does race detection for a write on an expanded record. */
+struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+{
+	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
+	struct DataRace * race = NULL;
+
+	/* Check for datarace against last read. */
+	race = fullRaceCheckReads(thread, location, record, currClock);
+	if (race)
+		goto Exit;
+
 	/* Check for datarace against last write. */
 	{
 		modelclock_t writeClock = record->writeClock;
@@ -296,11 +677,12 @@ struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, u
 		}
 	}
 Exit:
-	record->numReads = 0;
+	clearFullRecordReads(record);
 	record->writeThread = thread;
 	record->isAtomic = 0;
 	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
+	compactRecord(shadow, record);
 	return race;
 }
 
@@ -314,20 +696,9 @@ struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *locatio
 		goto Exit;
 
 	/* Check for datarace against last read. */
-
-	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
-
-		/* Note that readClock can't actuall be zero here, so it could be
-		         optimized. */
-
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
-			/* We have a datarace */
-			race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
-			goto Exit;
-		}
-	}
+	race = fullRaceCheckReads(thread, location, record, currClock);
+	if (race)
+		goto Exit;
 
 	/* Check for datarace against last write. */
 
@@ -342,11 +713,12 @@ struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *locatio
 		}
 	}
 Exit:
-	record->numReads = 0;
+	clearFullRecordReads(record);
 	record->writeThread = thread;
 	record->isAtomic = 1;
 	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
+	compactRecord(shadow, record);
 	return race;
 }
 
@@ -367,11 +739,10 @@ void atomraceCheckWrite(thread_id_t thread, void *location)
 	}
 
 	{
-		int threadid = id_to_int(thread);
 		modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+		/* Clock is too large. */
+		if (ourClock > MAXWRITEVECTOR) {
 			expandRecord(shadow);
 			race = atomfullRaceCheckWrite(thread, location, shadow, currClock);
 			goto Exit;
@@ -384,7 +755,7 @@ void atomraceCheckWrite(thread_id_t thread, void *location)
 		{
 			/* Check for datarace against last read. */
 			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+			thread_id_t readThread = clockOwner(readClock);
 
 			if (clock_may_race(currClock, thread, readClock, readThread)) {
 				/* We have a datarace */
@@ -396,7 +767,7 @@ void atomraceCheckWrite(thread_id_t thread, void *location)
 		{
 			/* Check for datarace against last write. */
 			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+			thread_id_t writeThread = clockOwner(writeClock);
 
 			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 				/* We have a datarace */
@@ -406,40 +777,34 @@ void atomraceCheckWrite(thread_id_t thread, void *location)
 		}
 
 ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock) | ATOMICMASK;
+		*shadow = ENCODEOP(0, ourClock) | ATOMICMASK;
 	}
 
 Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	if (race)
+		processDataRace(race);
 }
 
 /** This function does race detection for a write on an expanded record. */
 void fullRecordWrite(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock) {
 	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
-	record->numReads = 0;
+	clearFullRecordReads(record);
 	record->writeThread = thread;
 	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
 	record->isAtomic = 1;
+	compactRecord(shadow, record);
 }
 
 /** This function does race detection for a write on an expanded record. */
 void fullRecordWriteNonAtomic(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock) {
 	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
-	record->numReads = 0;
+	clearFullRecordReads(record);
 	record->writeThread = thread;
 	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
 	record->isAtomic = 0;
+	compactRecord(shadow, record);
 }
 
 /** This function just updates metadata on atomic write. */
@@ -453,17 +818,16 @@ void recordWrite(thread_id_t thread, void *location) {
 		return;
 	}
 
-	int threadid = id_to_int(thread);
 	modelclock_t ourClock = currClock->getClock(thread);
 
-	/* Thread ID is too large or clock is too large. */
-	if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+	/* Clock is too large. */
+	if (ourClock > MAXWRITEVECTOR) {
 		expandRecord(shadow);
 		fullRecordWrite(thread, location, shadow, currClock);
 		return;
 	}
 
-	*shadow = ENCODEOP(0, 0, threadid, ourClock) | ATOMICMASK;
+	*shadow = ENCODEOP(0, ourClock) | ATOMICMASK;
 }
 
 /** This function just updates metadata on atomic write. */
@@ -479,17 +843,16 @@ void recordCalloc(void *location, size_t size) {
 			return;
 		}
 
-		int threadid = id_to_int(thread);
 		modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+		/* Clock is too large. */
+		if (ourClock > MAXWRITEVECTOR) {
 			expandRecord(shadow);
 			fullRecordWriteNonAtomic(thread, location, shadow, currClock);
 			return;
 		}
 
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
+		*shadow = ENCODEOP(0, ourClock);
 		location = (void *)(((char *) location) + 1);
 	}
 }
@@ -509,55 +872,7 @@ struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, ui
 		race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
 	}
 
-	/* Shorten vector when possible */
-
-	int copytoindex = 0;
-
-	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
-
-		/*  Note that is not really a datarace check as reads cannot
-		                actually race.  It is just determining that this read subsumes
-		                another in the sense that either this read races or neither
-		                read races. Note that readClock can't actually be zero, so it
-		                could be optimized.  */
-
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
-			/* Still need this read in vector */
-			if (copytoindex != i) {
-				ASSERT(readThread >= 0);
-				record->readClock[copytoindex] = readClock;
-				record->thread[copytoindex] = readThread;
-			}
-			copytoindex++;
-		}
-	}
-
-	if (__builtin_popcount(copytoindex) <= 1) {
-		if (copytoindex == 0 && record->thread == NULL) {
-			int newCapacity = INITCAPACITY;
-			record->thread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * newCapacity);
-			record->readClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * newCapacity);
-		} else if (copytoindex>=INITCAPACITY) {
-			int newCapacity = copytoindex * 2;
-			thread_id_t *newthread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * newCapacity);
-			modelclock_t *newreadClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * newCapacity);
-			real_memcpy(newthread, record->thread, copytoindex * sizeof(thread_id_t));
-			real_memcpy(newreadClock, record->readClock, copytoindex * sizeof(modelclock_t));
-			snapshot_free(record->readClock);
-			snapshot_free(record->thread);
-			record->readClock = newreadClock;
-			record->thread = newthread;
-		}
-	}
-
-	modelclock_t ourClock = currClock->getClock(thread);
-
-	ASSERT(thread >= 0);
-	record->thread[copytoindex] = thread;
-	record->readClock[copytoindex] = ourClock;
-	record->numReads = copytoindex + 1;
+	fullRecordRead(thread, record, currClock);
 	return race;
 }
 
@@ -603,7 +918,7 @@ void atomraceCheckRead(thread_id_t thread, const void *location)
 	{
 		/* Check for datarace against last write. */
 		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+		thread_id_t writeThread = clockOwner(writeClock);
 
 		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 			/* We have a datarace */
@@ -612,16 +927,8 @@ void atomraceCheckRead(thread_id_t thread, const void *location)
 		}
 	}
 Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	if (race)
+		processDataRace(race);
 }
 
 static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void * location, uint64_t *old_val, uint64_t *new_val)
@@ -642,11 +949,10 @@ static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void *
 	}
 
 	{
-		int threadid = id_to_int(thread);
 		modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+		/* Clock is too large. */
+		if (ourClock > MAXWRITEVECTOR) {
 			expandRecord(shadow);
 			race = fullRaceCheckRead(thread, location, shadow, currClock);
 			goto Exit;
@@ -654,7 +960,7 @@ static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void *
 
 		/* Check for datarace against last write. */
 		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+		thread_id_t writeThread = clockOwner(writeClock);
 
 		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 			/* We have a datarace */
@@ -662,35 +968,24 @@ static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void *
 		}
 
 		modelclock_t readClock = READVECTOR(shadowval);
-		thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+		thread_id_t readThread = clockOwner(readClock);
 
 		if (clock_may_race(currClock, thread, readClock, readThread)) {
 			/* We don't subsume this read... Have to expand record. */
 			expandRecord(shadow);
-			struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-			record->thread[1] = thread;
-			record->readClock[1] = ourClock;
-			record->numReads++;
+			fullRecordRead(thread, (struct RaceRecord *) (*shadow), currClock);
 
 			goto Exit;
 		}
 
-		*shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock) | (shadowval & ATOMICMASK);
+		*shadow = ENCODEOP(ourClock, writeClock) | (shadowval & ATOMICMASK);
 
 		*old_val = shadowval;
 		*new_val = *shadow;
 	}
 Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	if (race)
+		processDataRace(race);
 
 	return shadow;
 }
@@ -712,11 +1007,10 @@ static inline void raceCheckRead_otherIt(thread_id_t thread, const void * locati
 	}
 
 	{
-		int threadid = id_to_int(thread);
 		modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+		/* Clock is too large. */
+		if (ourClock > MAXWRITEVECTOR) {
 			expandRecord(shadow);
 			race = fullRaceCheckRead(thread, location, shadow, currClock);
 			goto Exit;
@@ -724,7 +1018,7 @@ static inline void raceCheckRead_otherIt(thread_id_t thread, const void * locati
 
 		/* Check for datarace against last write. */
 		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+		thread_id_t writeThread = clockOwner(writeClock);
 
 		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 			/* We have a datarace */
@@ -732,36 +1026,27 @@ static inline void raceCheckRead_otherIt(thread_id_t thread, const void * locati
 		}
 
 		modelclock_t readClock = READVECTOR(shadowval);
-		thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+		thread_id_t readThread = clockOwner(readClock);
 
 		if (clock_may_race(currClock, thread, readClock, readThread)) {
 			/* We don't subsume this read... Have to expand record. */
 			expandRecord(shadow);
-			struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-			record->thread[1] = thread;
-			record->readClock[1] = ourClock;
-			record->numReads++;
+			fullRecordRead(thread, (struct RaceRecord *) (*shadow), currClock);
 
 			goto Exit;
 		}
 
-		*shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock) | (shadowval & ATOMICMASK);
+		*shadow = ENCODEOP(ourClock, writeClock) | (shadowval & ATOMICMASK);
 	}
 Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	if (race)
+		processDataRace(race);
 }
 
 void raceCheckRead64(thread_id_t thread, const void *location)
 {
+	if (!sampleRead())
+		return;
 	int old_flag = GET_MODEL_FLAG;
 	ENTER_MODEL_FLAG;
 
@@ -816,6 +1101,8 @@ L7:
 
 void raceCheckRead32(thread_id_t thread, const void *location)
 {
+	if (!sampleRead())
+		return;
 	int old_flag = GET_MODEL_FLAG;
 	ENTER_MODEL_FLAG;
 
@@ -850,6 +1137,8 @@ L3:
 
 void raceCheckRead16(thread_id_t thread, const void *location)
 {
+	if (!sampleRead())
+		return;
 	int old_flag = GET_MODEL_FLAG;
 	ENTER_MODEL_FLAG;
 
@@ -872,6 +1161,8 @@ void raceCheckRead16(thread_id_t thread, const void *location)
 
 void raceCheckRead8(thread_id_t thread, const void *location)
 {
+	if (!sampleRead())
+		return;
 	int old_flag = GET_MODEL_FLAG;
 	ENTER_MODEL_FLAG;
 
@@ -898,11 +1189,10 @@ static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void *
 	}
 
 	{
-		int threadid = id_to_int(thread);
 		modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+		/* Clock is too large. */
+		if (ourClock > MAXWRITEVECTOR) {
 			expandRecord(shadow);
 			race = fullRaceCheckWrite(thread, location, shadow, currClock);
 			goto Exit;
@@ -911,7 +1201,7 @@ static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void *
 		{
 			/* Check for datarace against last read. */
 			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+			thread_id_t readThread = clockOwner(readClock);
 
 			if (clock_may_race(currClock, thread, readClock, readThread)) {
 				/* We have a datarace */
@@ -923,7 +1213,7 @@ static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void *
 		{
 			/* Check for datarace against last write. */
 			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+			thread_id_t writeThread = clockOwner(writeClock);
 
 			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 				/* We have a datarace */
@@ -933,23 +1223,15 @@ static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void *
 		}
 
 ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
+		*shadow = ENCODEOP(0, ourClock);
 
 		*old_val = shadowval;
 		*new_val = *shadow;
 	}
 
 Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	if (race)
+		processDataRace(race);
 
 	return shadow;
 }
@@ -970,11 +1252,10 @@ static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * locat
 	}
 
 	{
-		int threadid = id_to_int(thread);
 		modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+		/* Clock is too large. */
+		if (ourClock > MAXWRITEVECTOR) {
 			expandRecord(shadow);
 			race = fullRaceCheckWrite(thread, location, shadow, currClock);
 			goto Exit;
@@ -983,7 +1264,7 @@ static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * locat
 		{
 			/* Check for datarace against last read. */
 			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+			thread_id_t readThread = clockOwner(readClock);
 
 			if (clock_may_race(currClock, thread, readClock, readThread)) {
 				/* We have a datarace */
@@ -995,7 +1276,7 @@ static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * locat
 		{
 			/* Check for datarace against last write. */
 			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+			thread_id_t writeThread = clockOwner(writeClock);
 
 			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 				/* We have a datarace */
@@ -1005,20 +1286,12 @@ static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * locat
 		}
 
 ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
+		*shadow = ENCODEOP(0, ourClock);
 	}
 
 Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	if (race)
+		processDataRace(race);
 }
 
 void raceCheckWrite64(thread_id_t thread, const void *location)
@@ -1167,11 +1440,10 @@ void raceCheckWriteMemop(thread_id_t thread, const void *location, size_t size)
 		}
 
 		{
-			int threadid = id_to_int(thread);
 			modelclock_t ourClock = currClock->getClock(thread);
 
-			/* Thread ID is too large or clock is too large. */
-			if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+			/* Clock is too large. */
+			if (ourClock > MAXWRITEVECTOR) {
 				expandRecord(shadow);
 				race = fullRaceCheckWrite(thread, location, shadow, currClock);
 				goto Exit;
@@ -1180,7 +1452,7 @@ void raceCheckWriteMemop(thread_id_t thread, const void *location, size_t size)
 			{
 				/* Check for datarace against last read. */
 				modelclock_t readClock = READVECTOR(shadowval);
-				thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+				thread_id_t readThread = clockOwner(readClock);
 
 				if (clock_may_race(currClock, thread, readClock, readThread)) {
 					/* We have a datarace */
@@ -1192,7 +1464,7 @@ void raceCheckWriteMemop(thread_id_t thread, const void *location, size_t size)
 			{
 				/* Check for datarace against last write. */
 				modelclock_t writeClock = WRITEVECTOR(shadowval);
-				thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+				thread_id_t writeThread = clockOwner(writeClock);
 
 				if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 					/* We have a datarace */
@@ -1202,24 +1474,17 @@ void raceCheckWriteMemop(thread_id_t thread, const void *location, size_t size)
 			}
 
 ShadowExit:
-			*shadow = ENCODEOP(0, 0, threadid, ourClock);
+			*shadow = ENCODEOP(0, ourClock);
 		}
 
 Exit:
 		if (race) {
-#ifdef REPORT_DATA_RACES
 			if (!alreadyHasRace) {
 				alreadyHasRace = true;
-				race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-				if (raceset->add(race))
-					assert_race(race);
-				else model_free(race);
+				processDataRace(race);
 			} else {
 				model_free(race);
 			}
-#else
-			model_free(race);
-#endif
 		}
 	}
 	RESTORE_MODEL_FLAG(old_flag);
@@ -1227,6 +1492,8 @@ Exit:
 
 void raceCheckReadMemop(thread_id_t thread, const void * location, size_t size)
 {
+	if (!sampleRead())
+		return;
 	int old_flag = GET_MODEL_FLAG;
 	ENTER_MODEL_FLAG;
 
@@ -1249,11 +1516,10 @@ void raceCheckReadMemop(thread_id_t thread, const void * location, size_t size)
 		}
 
 		{
-			int threadid = id_to_int(thread);
 			modelclock_t ourClock = currClock->getClock(thread);
 
-			/* Thread ID is too large or clock is too large. */
-			if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
+			/* Clock is too large. */
+			if (ourClock > MAXWRITEVECTOR) {
 				expandRecord(shadow);
 				race = fullRaceCheckRead(thread, location, shadow, currClock);
 				goto Exit;
@@ -1261,7 +1527,7 @@ void raceCheckReadMemop(thread_id_t thread, const void * location, size_t size)
 
 			/* Check for datarace against last write. */
 			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+			thread_id_t writeThread = clockOwner(writeClock);
 
 			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
 				/* We have a datarace */
@@ -1269,35 +1535,26 @@ void raceCheckReadMemop(thread_id_t thread, const void * location, size_t size)
 			}
 
 			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+			thread_id_t readThread = clockOwner(readClock);
 
 			if (clock_may_race(currClock, thread, readClock, readThread)) {
 				/* We don't subsume this read... Have to expand record. */
 				expandRecord(shadow);
-				struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-				record->thread[1] = thread;
-				record->readClock[1] = ourClock;
-				record->numReads++;
+				fullRecordRead(thread, (struct RaceRecord *) (*shadow), currClock);
 
 				goto Exit;
 			}
 
-			*shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock) | (shadowval & ATOMICMASK);
+			*shadow = ENCODEOP(ourClock, writeClock) | (shadowval & ATOMICMASK);
 		}
 Exit:
 		if (race) {
-#ifdef REPORT_DATA_RACES
 			if (!alreadyHasRace) {
-				race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-				if (raceset->add(race))
-					assert_race(race);
-				else model_free(race);
+				alreadyHasRace = true;
+				processDataRace(race);
 			} else {
 				model_free(race);
 			}
-#else
-			model_free(race);
-#endif
 		}
 	}
 	RESTORE_MODEL_FLAG(old_flag);
@@ -1315,5 +1572,12 @@ void print_normal_accesses()
 	model_print("load  16 count: %u\n", load16_count);
 	model_print("load  32 count: %u\n", load32_count);
 	model_print("load  64 count: %u\n", load64_count);
+
+	model_print("race records in use: %u of %u allocated\n", records_inuse, records_allocated);
+	for (int i = 0;i < NUMREADCLASSES;i++) {
+		if (readclocks_allocated[i] != 0)
+			model_print("read clocks of %5d entries in use: %u of %u allocated\n", 1 << (i + MINREADCLASS), readclocks_inuse[i], readclocks_allocated[i]);
+	}
+	model_print("large read clocks in use: %u\n", readclocks_large);
 }
 #endif
@@ -10,6 +10,8 @@
 #include "modeltypes.h"
 #include "classlist.h"
 #include "hashset.h"
+#include "hashtable.h"
+#include "params.h"
 
 struct ShadowTable {
 	void * array[65536];
@@ -19,6 +21,10 @@ struct ShadowBaseTable {
 	uint64_t array[65536];
 };
 
+struct ClockOwnerTable {
+	thread_id_t array[65536];
+};
+
 struct DataRace {
 	/* Clock and thread associated with first action.  This won't change in
 	         response to synchronization. */
@@ -42,7 +48,7 @@ struct DataRace {
 
 #define MASK16BIT 0xffff
 
-void initRaceDetector();
+void initRaceDetector(struct model_params *params);
 void atomraceCheckWrite(thread_id_t thread, void *location);
 void atomraceCheckRead(thread_id_t thread, const void *location);
 void recordWrite(thread_id_t thread, void *location);
@@ -51,6 +57,7 @@ void assert_race(struct DataRace *race);
 bool hasNonAtomicStore(const void *location);
 void setAtomicStoreFlag(const void *location);
 void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelclock_t * clock);
+void recordClockOwner(modelclock_t clock, thread_id_t thread);
 
 void raceCheckRead8(thread_id_t thread, const void *location);
 void raceCheckRead16(thread_id_t thread, const void *location);
@@ -71,12 +78,30 @@ void print_normal_accesses();
 
 /**
  * @brief A record of information for detecting data races
+ *
+ * Reads use the FastTrack adaptive representation: while the reads of a
+ * location are totally ordered by happens-before, only the last read is kept
+ * as an epoch (readThread, readEpoch).  A read that is concurrent with the
+ * last one inflates the record to a read vector clock (readClock, indexed by
+ * thread id), and the next write deflates it back to an epoch.
+ *
+ * Records and read vector clocks come from a dedicated pool in the
+ * snapshotting heap (see allocRaceRecord), so they are reclaimed on rollback.
  */
 struct RaceRecord {
-	modelclock_t *readClock;
-	thread_id_t *thread;
-	int numReads : 31;
+	union {
+		/** @brief Read vector clock; only valid while readShared is set */
+		modelclock_t *readClock;
+		/** @brief Next record in the pool's free list */
+		struct RaceRecord *nextFree;
+	};
+	/** @brief Number of entries allocated in readClock */
+	int readCapacity;
+	int readShared : 1;
 	int isAtomic : 1;
+	/** @brief Epoch of the last read; readEpoch is 0 if there is none */
+	thread_id_t readThread;
+	modelclock_t readEpoch;
 	thread_id_t writeThread;
 	modelclock_t writeClock;
 };
@@ -84,19 +109,13 @@ struct RaceRecord {
 unsigned int race_hash(struct DataRace *race);
 bool race_equals(struct DataRace *r1, struct DataRace *r2);
 
-#define INITCAPACITY 4
-
 #define ISSHORTRECORD(x) ((x)&0x1)
 
-#define THREADMASK 0x3f
-#define RDTHREADID(x) (((x)>>1)&THREADMASK)
-#define READMASK 0x1ffffff
-#define READVECTOR(x) (((x)>>7)&READMASK)
-
-#define WRTHREADID(x) (((x)>>32)&THREADMASK)
+#define READMASK 0x7fffffff
+#define READVECTOR(x) (((x)>>1)&READMASK)
 
 #define WRITEMASK READMASK
-#define WRITEVECTOR(x) (((x)>>38)&WRITEMASK)
+#define WRITEVECTOR(x) (((x)>>32)&WRITEMASK)
 
 #define ATOMICMASK (0x1ULL << 63)
 #define NONATOMICMASK ~(0x1ULL << 63)
@@ -107,15 +126,18 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2);
  *  -# encodes the information in a 64 bit word. Encoding is as
  *     follows:
  *     - lowest bit set to 1
- *     - next 6 bits are read thread id
- *     - next 25 bits are read clock vector
- *     - next 6 bits are write thread id
- *     - next 25 bits are write clock vector
+ *     - next 31 bits are read clock vector
+ *     - next 31 bits are write clock vector
  *     - highest bit is 1 if the write is from an atomic
+ *
+ * The compact form does not store thread ids.  Clocks are sequence numbers,
+ * so each non-zero clock belongs to exactly one thread; the owning thread is
+ * recovered from the per-execution clock owner table (see
+ * recordClockOwner).  This keeps programs with any number of threads on the
+ * allocation-free compact form until clocks exceed 31 bits.
  */
-#define ENCODEOP(rdthread, rdtime, wrthread, wrtime) (0x1ULL | ((rdthread)<<1) | ((rdtime) << 7) | (((uint64_t)wrthread)<<32) | (((uint64_t)wrtime)<<38))
+#define ENCODEOP(rdtime, wrtime) (0x1ULL | (((uint64_t)rdtime) << 1) | (((uint64_t)wrtime)<<32))
 
-#define MAXTHREADID (THREADMASK-1)
 #define MAXREADVECTOR (READMASK-1)
 #define MAXWRITEVECTOR (WRITEMASK-1)
 
@@ -123,5 +145,7 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2);
 #define CHECKBOUNDARY(location, bits) ((((uintptr_t)location & MASK16BIT) + bits) <= MASK16BIT)
 
 typedef HashSet<struct DataRace *, uintptr_t, 0, model_malloc, model_calloc, model_free, race_hash, race_equals> RaceSet;
+typedef HashSet<uintptr_t, uintptr_t, 0, model_malloc, model_calloc, model_free> RaceKeySet;
+typedef HashTable<uintptr_t, unsigned int, uintptr_t, 0, model_malloc, model_calloc, model_free> RaceSiteTable;
 
 #endif	/* __DATARACE_H__ */
@@ -30,6 +30,8 @@ static unsigned int atomic_unlock_count = 0;
 static unsigned int atomic_notify_count = 0;
 static unsigned int atomic_wait_count = 0;
 static unsigned int atomic_timedwait_count = 0;
+
+static unsigned int rf_buffer_grow_count = 0;
 #endif
 
 /**
@@ -77,6 +79,9 @@ ModelExecution::ModelExecution(ModelChecker *m, Scheduler *scheduler) :
 	cond_map(),
 	thrd_last_action(1),
 	thrd_last_fence_release(),
+	thrd_sc_fences(),
+	rf_set_buf(),
+	priorset_buf(),
 	priv(new struct model_snapshot_members ()),
 	mo_graph(new CycleGraph()),
 	fuzzer(new Fuzzer()),
@@ -127,11 +132,11 @@ static simple_action_list_t * get_safe_ptr_action(HashTable<const void *, simple
 	return tmp;
 }
 
-static SnapVector<simple_action_list_t> * get_safe_ptr_vect_action(HashTable<const void *, SnapVector<simple_action_list_t> *, uintptr_t, 2> * hash, void * ptr)
+static SnapVector<WriteLog> * get_safe_ptr_vect_action(HashTable<const void *, SnapVector<WriteLog> *, uintptr_t, 2> * hash, void * ptr)
 {
-	SnapVector<simple_action_list_t> *tmp = hash->get(ptr);
+	SnapVector<WriteLog> *tmp = hash->get(ptr);
 	if (tmp == NULL) {
-		tmp = new SnapVector<simple_action_list_t>();
+		tmp = new SnapVector<WriteLog>();
 		hash->put(ptr, tmp);
 	}
 	return tmp;
@@ -203,6 +208,9 @@ void print_atomic_accesses()
 	model_print("atomic notify count: %u\n", atomic_notify_count);
 	model_print("atomic wait   count: %u\n", atomic_wait_count);
 	model_print("atomic timedwait count: %u\n", atomic_timedwait_count);
+	model_print("rf buffer grow count: %u\n", rf_buffer_grow_count);
+	model_print("action high-water count: %u\n", SnapshotSlab<sizeof(ModelAction)>::getHighWater());
+	model_print("list node high-water count: %u\n", SnapshotSlab<sizeof(sllnode<ModelAction *>)>::getHighWater());
 }
 #endif
 /** @return a thread ID for a new Thread */
@@ -391,7 +399,12 @@ ModelAction * ModelExecution::convertNonAtomicStore(void * location) {
  */
 bool ModelExecution::process_read(ModelAction *curr, SnapVector<ModelAction *> * rf_set)
 {
-	SnapVector<ModelAction *> * priorset = new SnapVector<ModelAction *>();
+	SnapVector<ModelAction *> * priorset = &priorset_buf;
+#ifdef COLLECT_STAT
+	uint rf_capacity = rf_set->getCapacity();
+	uint prior_capacity = priorset->getCapacity();
+#endif
+	priorset->clear();
 	bool hasnonatomicstore = hasNonAtomicStore(curr->get_location());
 	if (hasnonatomicstore) {
 		ModelAction * nonatomicstore = convertNonAtomicStore(curr->get_location());
@@ -418,12 +431,15 @@ bool ModelExecution::process_read(ModelAction *curr, SnapVector<ModelAction *> *
 		ASSERT(rf);
 		bool canprune = false;
 		if (r_modification_order(curr, rf, priorset, &canprune)) {
-			for(unsigned int i=0;i<priorset->size();i++) {
-				mo_graph->addEdge((*priorset)[i], rf);
-			}
+			mo_graph->addEdges(priorset, rf);
 			read_from(curr, rf);
 			get_thread(curr)->set_return_value(rf->get_write_value());
-			delete priorset;
+#ifdef COLLECT_STAT
+			if (rf_set->getCapacity() != rf_capacity)
+				rf_buffer_grow_count++;
+			if (priorset->getCapacity() != prior_capacity)
+				rf_buffer_grow_count++;
+#endif
 			//Update acquire fence clock vector
 			ClockVector * hbcv = get_hb_from_write(rf);
 			if (hbcv != NULL)
@@ -716,6 +732,7 @@ bool ModelExecution::initialize_curr_action(ModelAction **curr)
 		ModelAction *newcurr = *curr;
 
 		newcurr->set_seq_number(get_next_seq_num());
+		recordClockOwner(newcurr->get_seq_number(), newcurr->get_tid());
 		/* Always compute new clock vector */
 		newcurr->create_cv(get_parent_action(newcurr->get_tid()));
 
@@ -854,7 +871,6 @@ ModelAction * ModelExecution::check_current_action(ModelAction *curr)
 			auto action_read_from = rf_set->at(i);
 			relations_graph.addEdge(action_read_from, RelationGraphEdge(READ_FROM, curr));
 		}
-		delete rf_set;
 	} else
 		ASSERT(rf_set == NULL);
 
@@ -969,10 +985,25 @@ bool ModelExecution::r_modification_order(ModelAction *curr, const ModelAction *
 			continue;
 		}
 
+		/* Every action in the list belongs to thread tid, so it happens
+		 * before curr iff its sequence number is within curr's clock */
+		modelclock_t hb_clock = curr->get_cv()->getClock(tid);
+
+		/* Later actions neither happen before curr nor precede one of the
+		 * SC fences below, so the scan can start at the last action up to
+		 * this bound */
+		modelclock_t bound = hb_clock;
+		if (curr->is_seqcst() && last_sc_fence_thread_local)
+			bound = std::max(bound, last_sc_fence_thread_local->get_seq_number() - 1);
+		if (last_sc_fence_local)
+			bound = std::max(bound, last_sc_fence_local->get_seq_number() - 1);
+		if (last_sc_fence_thread_before)
+			bound = std::max(bound, last_sc_fence_thread_before->get_seq_number() - 1);
+
 		/* Iterate over actions in thread, starting from most recent */
 		action_list_t *list = &(*thrd_lists)[tid];
 		sllnode<ModelAction *> * rit;
-		for (rit = list->end();rit != NULL;rit=rit->getPrev()) {
+		for (rit = list->findFrontier(curr->get_tid(), bound);rit != NULL;rit=rit->getPrev()) {
 			ModelAction *act = rit->getVal();
 
 			/* Skip curr */
@@ -980,7 +1011,7 @@ bool ModelExecution::r_modification_order(ModelAction *curr, const ModelAction *
 				continue;
 			/* Don't want to add reflexive edges on 'rf' */
 			if (act->equals(rf)) {
-				if (act->happens_before(curr))
+				if (act->get_seq_number() <= hb_clock)
 					break;
 				else
 					continue;
@@ -1017,7 +1048,7 @@ bool ModelExecution::r_modification_order(ModelAction *curr, const ModelAction *
 			 * Include at most one act per-thread that "happens
 			 * before" curr
 			 */
-			if (act->happens_before(curr)) {
+			if (act->get_seq_number() <= hb_clock) {
 				if (i==0) {
 					if (last_sc_fence_local == NULL ||
 							(*last_sc_fence_local < *act)) {
@@ -1101,10 +1132,16 @@ void ModelExecution::w_modification_order(ModelAction *curr)
 		if (last_sc_fence_local && int_to_id((int)i) != curr->get_tid())
 			last_sc_fence_thread_before = get_last_seq_cst_fence(int_to_id(i), last_sc_fence_local);
 
+		/* Actions in the list belong to thread i; see r_modification_order */
+		modelclock_t hb_clock = curr->get_cv()->getClock(int_to_id(i));
+		modelclock_t bound = hb_clock;
+		if (last_sc_fence_thread_before)
+			bound = std::max(bound, last_sc_fence_thread_before->get_seq_number() - 1);
+
 		/* Iterate over actions in thread, starting from most recent */
 		action_list_t *list = &(*thrd_lists)[i];
 		sllnode<ModelAction*>* rit;
-		for (rit = list->end();rit != NULL;rit=rit->getPrev()) {
+		for (rit = list->findFrontier(curr->get_tid(), bound);rit != NULL;rit=rit->getPrev()) {
 			ModelAction *act = rit->getVal();
 			if (act == curr) {
 				/*
@@ -1138,7 +1175,7 @@ void ModelExecution::w_modification_order(ModelAction *curr)
 			 * Include at most one act per-thread that "happens
 			 * before" curr
 			 */
-			if (act->happens_before(curr)) {
+			if (act->get_seq_number() <= hb_clock) {
 				/*
 				 * Note: if act is RMW, just add edge:
 				 *   act --mo--> curr
@@ -1231,7 +1268,7 @@ ClockVector * ModelExecution::get_hb_from_write(ModelAction *rf) const {
 void ModelExecution::add_action_to_lists(ModelAction *act, bool canprune)
 {
 	int tid = id_to_int(act->get_tid());
-	if ((act->is_fence() && act->is_seqcst()) || act->is_unlock()) {
+	if (act->is_unlock()) {
 		simple_action_list_t *list = get_safe_ptr_action(&obj_map, act->get_location());
 		act->setActionRef(list->add_back(act));
 	}
@@ -1265,6 +1302,15 @@ void ModelExecution::add_action_to_lists(ModelAction *act, bool canprune)
 		thrd_last_fence_release[tid] = act;
 	}
 
+	// Update thrd_sc_fences, the seq_cst fences taken by each thread
+	if (act->is_fence() && act->is_seqcst()) {
+		if ((int)thrd_sc_fences.size() <= tid)
+			thrd_sc_fences.resize(get_num_threads());
+		if (thrd_sc_fences[tid] == NULL)
+			thrd_sc_fences[tid] = new SnapVector<ModelAction *>();
+		thrd_sc_fences[tid]->push_back(act);
+	}
+
 	if (act->is_wait()) {
 		void *mutex_loc = (void *) act->get_value();
 		act->setActionRef(get_safe_ptr_action(&obj_map, mutex_loc)->add_back(act));
@@ -1313,15 +1359,15 @@ void ModelExecution::add_normal_write_to_lists(ModelAction *act)
 
 
 void ModelExecution::add_write_to_lists(ModelAction *write) {
-	SnapVector<simple_action_list_t> *vec = get_safe_ptr_vect_action(&obj_wr_thrd_map, write->get_location());
+	SnapVector<WriteLog> *vec = get_safe_ptr_vect_action(&obj_wr_thrd_map, write->get_location());
 	int tid = id_to_int(write->get_tid());
 	if (tid >= (int)vec->size()) {
 		uint oldsize =vec->size();
 		vec->resize(priv->next_thread_id);
 		for(uint i=oldsize;i<priv->next_thread_id;i++)
-			new (&(*vec)[i]) simple_action_list_t();
+			new (&(*vec)[i]) WriteLog();
 	}
-	write->setActionRef((*vec)[tid].add_back(write));
+	(*vec)[tid].add(write);
 }
 
 /**
@@ -1376,29 +1422,27 @@ ModelAction * ModelExecution::get_last_seq_cst_write(ModelAction *curr) const
  */
 ModelAction * ModelExecution::get_last_seq_cst_fence(thread_id_t tid, const ModelAction *before_fence) const
 {
-	/* All fences should have location FENCE_LOCATION */
-	simple_action_list_t *list = obj_map.get(FENCE_LOCATION);
-
-	if (!list)
+	int threadid = id_to_int(tid);
+	if (threadid >= (int)thrd_sc_fences.size() || thrd_sc_fences[threadid] == NULL)
 		return NULL;
 
-	sllnode<ModelAction*>* rit = list->end();
-
-	if (before_fence) {
-		for (;rit != NULL;rit=rit->getPrev())
-			if (rit->getVal() == before_fence)
-				break;
-
-		ASSERT(rit->getVal() == before_fence);
-		rit=rit->getPrev();
-	}
-
-	for (;rit != NULL;rit=rit->getPrev()) {
-		ModelAction *act = rit->getVal();
-		if (act->is_fence() && (tid == act->get_tid()) && act->is_seqcst())
-			return act;
+	SnapVector<ModelAction *> *fences = thrd_sc_fences[threadid];
+	if (fences->empty())
+		return NULL;
+	if (before_fence == NULL)
+		return fences->back();
+
+	/* Binary search for the last fence sequenced before before_fence */
+	modelclock_t seq = before_fence->get_seq_number();
+	uint low = 0, high = fences->size();
+	while (low < high) {
+		uint mid = (low + high) / 2;
+		if ((*fences)[mid]->get_seq_number() < seq)
+			low = mid + 1;
+		else
+			high = mid;
 	}
-	return NULL;
+	return low == 0 ? NULL : (*fences)[low - 1];
 }
 
 /**
@@ -1466,10 +1510,11 @@ bool valequals(uint64_t val1, uint64_t val2, int size) {
  *
  * @param curr is the current ModelAction that we are exploring; it must be a
  * 'read' operation.
+ * @return The set, held in a buffer that the next read reuses
  */
 SnapVector<ModelAction *> *  ModelExecution::build_may_read_from(ModelAction *curr)
 {
-	SnapVector<simple_action_list_t> *thrd_lists = obj_wr_thrd_map.get(curr->get_location());
+	SnapVector<WriteLog> *thrd_lists = obj_wr_thrd_map.get(curr->get_location());
 	unsigned int i;
 	ASSERT(curr->is_read());
 
@@ -1478,24 +1523,29 @@ SnapVector<ModelAction *> *  ModelExecution::build_may_read_from(ModelAction *cu
 	if (curr->is_seqcst())
 		last_sc_write = get_last_seq_cst_write(curr);
 
-	SnapVector<ModelAction *> * rf_set = new SnapVector<ModelAction *>();
+	SnapVector<ModelAction *> * rf_set = &rf_set_buf;
+	rf_set->clear();
 
 	/* Iterate over all threads */
 	if (thrd_lists != NULL)
 		for (i = 0;i < thrd_lists->size();i++) {
-			/* Iterate over actions in thread, starting from most recent */
-			simple_action_list_t *list = &(*thrd_lists)[i];
-			sllnode<ModelAction *> * rit;
-			for (rit = list->end();rit != NULL;rit=rit->getPrev()) {
-				ModelAction *act = rit->getVal();
+			/* Writes in the log belong to thread i; see r_modification_order */
+			modelclock_t hb_clock = curr->get_cv()->getClock(int_to_id(i));
+			modelclock_t sc_clock = last_sc_write != NULL ? last_sc_write->get_cv()->getClock(int_to_id(i)) : 0;
+
+			/* Iterate over writes in thread, starting from most recent */
+			WriteLog *log = &(*thrd_lists)[i];
+			for (uint index = log->end();index > log->begin();) {
+				index--;
+				ModelAction *act = log->getAction(index);
 
-				if (act == curr)
+				if (act == NULL || act == curr)
 					continue;
 
 				/* Don't consider more than one seq_cst write if we are a seq_cst read. */
 				bool allow_read = true;
 
-				if (curr->is_seqcst() && (act->is_seqcst() || (last_sc_write != NULL && act->happens_before(last_sc_write))) && act != last_sc_write)
+				if (curr->is_seqcst() && (log->isSeqCst(index) || log->getSeq(index) <= sc_clock) && act != last_sc_write)
 					allow_read = false;
 
 				/* Need to check whether we will have two RMW reading from the same value */
@@ -1518,7 +1568,7 @@ SnapVector<ModelAction *> *  ModelExecution::build_may_read_from(ModelAction *cu
 				}
 
 				/* Include at most one act per-thread that "happens before" curr */
-				if (act->happens_before(curr))
+				if (log->getSeq(index) <= hb_clock)
 					break;
 			}
 		}
@@ -1782,7 +1832,14 @@ void ModelExecution::removeAction(ModelAction *act) {
 		SnapVector<action_list_t> *vec = get_safe_ptr_vect_action(&obj_thrd_map, act->get_location());
 		(*vec)[act->get_tid()].removeAction(act);
 	}
-	if ((act->is_fence() && act->is_seqcst()) || act->is_unlock()) {
+	if (act->is_fence() && act->is_seqcst()) {
+		SnapVector<ModelAction *> *fences = thrd_sc_fences[id_to_int(act->get_tid())];
+		for (uint i = 0;i < fences->size();i++)
+			if ((*fences)[i] == act) {
+				fences->removeAt(i);
+				break;
+			}
+	} else if (act->is_unlock()) {
 		sllnode<ModelAction *> * listref = act->getActionRef();
 		if (listref != NULL) {
 			simple_action_list_t *list = get_safe_ptr_action(&obj_map, act->get_location());
@@ -1795,11 +1852,9 @@ void ModelExecution::removeAction(ModelAction *act) {
 			get_safe_ptr_action(&obj_map, mutex_loc)->erase(listref);
 		}
 	} else if (act->is_free()) {
-		sllnode<ModelAction *> * listref = act->getActionRef();
-		if (listref != NULL) {
-			SnapVector<simple_action_list_t> *vec = get_safe_ptr_vect_action(&obj_wr_thrd_map, act->get_location());
-			(*vec)[act->get_tid()].erase(listref);
-		}
+		SnapVector<WriteLog> *vec = obj_wr_thrd_map.get(act->get_location());
+		if (vec != NULL && id_to_int(act->get_tid()) < (int)vec->size())
+			(*vec)[act->get_tid()].remove(act);
 
 		//Clear it from last_sc_map
 		if (obj_last_sc_map.get(act->get_location()) == act) {
@@ -1836,6 +1891,7 @@ ClockVector * ModelExecution::computeMinimalCV() {
 void ModelExecution::fixupLastAct(ModelAction *act) {
 	ModelAction *newact = new ModelAction(ATOMIC_NOP, std::memory_order_seq_cst, NULL, VALUE_NONE, get_thread(act->get_tid()));
 	newact->set_seq_number(get_next_seq_num());
+	recordClockOwner(newact->get_seq_number(), newact->get_tid());
 	newact->create_cv(act);
 	newact->set_last_fence_release(act->get_last_fence_release());
 	add_action_to_lists(newact, false);
@@ -1887,6 +1943,8 @@ void ModelExecution::collectActions() {
 					queue->pop_back();
 					for(unsigned int i=0;i<node->getNumInEdges();i++) {
 						CycleNode * prevnode = node->getInEdge(i);
+						if (prevnode == NULL)
+							continue;
 						ModelAction * prevact = prevnode->getAction();
 						if (prevact->get_type() != READY_FREE) {
 							prevact->set_free();
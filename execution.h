@@ -19,6 +19,7 @@
 #include <condition_variable>
 #include "classlist.h"
 #include "relationsgraph.h"
+#include "writelog.h"
 
 #define INITIAL_THREAD_ID	0
 #define MAIN_THREAD_ID		1
@@ -153,7 +154,7 @@ private:
 
 	/** Per-object list of actions. Maps an object (i.e., memory location)
 	 * to a trace of all actions performed on the object.
-	 * Used only for SC fences, unlocks, & wait.
+	 * Used only for unlocks & wait.
 	 */
 	HashTable<const void *, simple_action_list_t *, uintptr_t, 2> obj_map;
 
@@ -164,8 +165,8 @@ private:
 	/** Per-object list of actions that each thread performed. */
 	HashTable<const void *, SnapVector<action_list_t> *, uintptr_t, 2> obj_thrd_map;
 
-	/** Per-object list of writes that each thread performed. */
-	HashTable<const void *, SnapVector<simple_action_list_t> *, uintptr_t, 2> obj_wr_thrd_map;
+	/** Per-object log of writes that each thread performed. */
+	HashTable<const void *, SnapVector<WriteLog> *, uintptr_t, 2> obj_wr_thrd_map;
 
 	HashTable<const void *, ModelAction *, uintptr_t, 4> obj_last_sc_map;
 
@@ -183,6 +184,15 @@ private:
 	SnapVector<ModelAction *> thrd_last_action;
 	SnapVector<ModelAction *> thrd_last_fence_release;
 
+	/** The seq_cst fences each thread performed, oldest first, so they
+	 *  are sorted by sequence number; NULL for threads without any */
+	SnapVector<SnapVector<ModelAction *> *> thrd_sc_fences;
+
+	/** Scratch buffers for the may-read-from set and prior writes of the
+	 *  read being processed; reused so reads do not allocate */
+	SnapVector<ModelAction *> rf_set_buf;
+	SnapVector<ModelAction *> priorset_buf;
+
 	/** A special model-checker Thread; used for associating with
 	 *  model-checker-related ModelAcitons */
 	Thread *model_thread;
@@ -8,7 +8,8 @@
  */
 
 /** @file hashtable.h
- *  @brief Hashtable.  Standard chained bucket variety.
+ *  @brief Hashtable.  Open addressing with per-slot control bytes, probed a
+ *  group of slots at a time.
  */
 
 #ifndef __HASHTABLE_H__
@@ -17,6 +18,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "mymemory.h"
 #include "common.h"
 
@@ -34,7 +39,9 @@ struct hashlistnode {
 
 template<typename _Key, int _Shift, typename _KeyInt>
 inline unsigned int default_hash_function(_Key hash) {
-	return (unsigned int)(((_KeyInt)hash) >> _Shift);
+	uint64_t key = ((uint64_t)(_KeyInt)hash) >> _Shift;
+	/* Fold the high half in so that keys from distant mappings differ */
+	return (unsigned int)(key ^ (key >> 32));
 }
 
 template<typename _Key>
@@ -42,6 +49,70 @@ inline bool default_equals(_Key key1, _Key key2) {
 	return key1 == key2;
 }
 
+/** @brief Number of slots whose control bytes are tested together */
+#define HT_GROUPWIDTH 16
+/** @brief Control byte of a slot that was never used */
+#define HT_EMPTY ((uint8_t)0x00)
+/** @brief Control byte of a slot whose entry was removed */
+#define HT_DELETED ((uint8_t)0x01)
+/** @brief Set in the control byte of a full slot */
+#define HT_FULL ((uint8_t)0x80)
+
+/**
+ * @brief The control bytes of one group of slots
+ *
+ * A full slot's control byte holds HT_FULL plus 7 bits of its key's hash, so
+ * a lookup compares a whole group against those bits at once and only checks
+ * the keys of the slots that match.  Empty slots are zero, so that a table
+ * from _calloc starts out empty.
+ */
+struct HashGroup {
+#ifdef __SSE2__
+	HashGroup(const uint8_t *ctrl) : ctrl(_mm_loadu_si128((const __m128i *)ctrl)) {}
+
+	/** @return Bit mask of the slots whose control byte is h2 */
+	unsigned int match(uint8_t h2) const {
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+	}
+
+	/** @return Bit mask of the empty slots */
+	unsigned int matchEmpty() const {
+		return match(HT_EMPTY);
+	}
+
+	/** @return Bit mask of the empty and deleted slots */
+	unsigned int matchFree() const {
+		return _mm_movemask_epi8(ctrl) ^ 0xffff;
+	}
+
+	__m128i ctrl;
+#else
+	HashGroup(const uint8_t *ctrl) : ctrl(ctrl) {}
+
+	unsigned int match(uint8_t h2) const {
+		unsigned int mask = 0;
+		for (int i = 0;i < HT_GROUPWIDTH;i++)
+			if (ctrl[i] == h2)
+				mask |= 1 << i;
+		return mask;
+	}
+
+	unsigned int matchEmpty() const {
+		return match(HT_EMPTY);
+	}
+
+	unsigned int matchFree() const {
+		unsigned int mask = 0;
+		for (int i = 0;i < HT_GROUPWIDTH;i++)
+			if (!(ctrl[i] & HT_FULL))
+				mask |= 1 << i;
+		return mask;
+	}
+
+	const uint8_t *ctrl;
+#endif
+};
+
 /**
  * @brief A simple, custom hash table
  *
@@ -50,6 +121,11 @@ inline bool default_equals(_Key key1, _Key key2) {
  * a key and is designed primarily with pointer-based keys in mind. Other
  * primitive key types are supported only for non-zero values.
  *
+ * The slots are split into groups of HT_GROUPWIDTH.  The hash, scrambled by
+ * a multiplication, picks the first group to probe and the 7 bits stored in
+ * the control byte; further groups are probed triangularly until one with an
+ * empty slot is seen.
+ *
  * @tparam _Key    Type name for the key
  * @tparam _Val    Type name for the values to be stored
  * @tparam _KeyInt Integer type that is at least as large as _Key. Used for key
@@ -73,20 +149,14 @@ public:
 	 * resized. Default ratio 0.5.
 	 */
 	HashTable(unsigned int initialcapacity = 1024, double factor = 0.5) {
-		// Allocate space for the hash table
-		table = (struct hashlistnode<_Key, _Val> *)_calloc(initialcapacity, sizeof(struct hashlistnode<_Key, _Val>));
 		zero = NULL;
 		loadfactor = factor;
-		capacity = initialcapacity;
-		capacitymask = initialcapacity - 1;
-
-		threshold = (unsigned int)(initialcapacity * loadfactor);
-		size = 0;	// Initial number of elements in the hash
+		allocate(initialcapacity);
 	}
 
 	/** @brief Hash table destructor */
 	~HashTable() {
-		_free(table);
+		_free(ctrl);
 		if (zero)
 			_free(zero);
 	}
@@ -113,52 +183,37 @@ public:
 
 	/** @brief Reset the table to its initial state. */
 	void reset() {
-		real_memset(table, 0, capacity * sizeof(struct hashlistnode<_Key, _Val>));
+		real_memset(ctrl, 0, capacity);
 		if (zero) {
 			_free(zero);
 			zero = NULL;
 		}
 		size = 0;
+		used = 0;
 	}
 
 	void resetanddelete() {
 		for(unsigned int i=0;i<capacity;i++) {
-			struct hashlistnode<_Key, _Val> *bin = &table[i];
-			if (bin->key != NULL) {
-				bin->key = NULL;
-				if (bin->val != NULL) {
-					delete bin->val;
-					bin->val = NULL;
-				}
-			}
+			if (isFull(i) && table[i].val != NULL)
+				delete table[i].val;
 		}
 		if (zero) {
 			if (zero->val != NULL)
 				delete zero->val;
-			_free(zero);
-			zero = NULL;
 		}
-		size = 0;
+		reset();
 	}
 
 	void resetandfree() {
 		for(unsigned int i=0;i<capacity;i++) {
-			struct hashlistnode<_Key, _Val> *bin = &table[i];
-			if (bin->key != NULL) {
-				bin->key = NULL;
-				if (bin->val != NULL) {
-					_free(bin->val);
-					bin->val = NULL;
-				}
-			}
+			if (isFull(i) && table[i].val != NULL)
+				_free(table[i].val);
 		}
 		if (zero) {
 			if (zero->val != NULL)
 				_free(zero->val);
-			_free(zero);
-			zero = NULL;
 		}
-		size = 0;
+		reset();
 	}
 
 	/**
@@ -178,42 +233,25 @@ public:
 			return;
 		}
 
-		if (size > threshold)
-			resize(capacity << 1);
-
-		struct hashlistnode<_Key, _Val> *search;
-		struct hashlistnode<_Key, _Val> *first = NULL;
-
-		unsigned int index = hash_function(key) & capacitymask;
-		unsigned int oindex = index;
-		do {
-			search = &table[index];
-			if (!search->key) {
-				//key is null, probably done
-				if (!search->val)
-					break;
-				if (first == NULL)
-					first = search;
-			}
-			if (equals(search->key, key)) {
-				search->val = val;
-				return;
-			}
-			index = (index + 1) & capacitymask;
-			if (index == oindex) {
-				if (first == NULL)
-					exit(-1);
-				break;
+		uint64_t hash = scramble(key);
+		int index = find(key, hash);
+		if (index >= 0) {
+			table[index].val = val;
+			return;
+		}
+
+		index = findFree(hash);
+		if (ctrl[index] == HT_EMPTY) {
+			if (used >= threshold) {
+				/* Drop the deleted slots, or grow if few were deleted */
+				resize(size - (zero != NULL) >= threshold / 2 ? capacity << 1 : capacity);
+				index = findFree(hash);
 			}
-		} while (true);
-
-		if (first != NULL) {
-			first->key = key;
-			first->val = val;
-		} else {
-			search->key = key;
-			search->val = val;
+			used++;
 		}
+		ctrl[index] = h2(hash);
+		table[index].key = key;
+		table[index].val = val;
 		size++;
 	}
 
@@ -223,8 +261,6 @@ public:
 	 * @return The value in the table, if the key is found; otherwise 0
 	 */
 	_Val get(_Key key) const {
-		struct hashlistnode<_Key, _Val> *search;
-
 		/* HashTable cannot handle 0 as a key */
 		if (!key) {
 			if (zero)
@@ -233,22 +269,8 @@ public:
 				return (_Val) 0;
 		}
 
-		unsigned int oindex = hash_function(key) & capacitymask;
-		unsigned int index = oindex;
-		do {
-			search = &table[index];
-			if (!search->key) {
-				if (!search->val)
-					break;
-			} else
-			if (equals(search->key, key))
-				return search->val;
-			index++;
-			index &= capacitymask;
-			if (index==oindex)
-				break;
-		} while (true);
-		return (_Val)0;
+		int index = find(key, scramble(key));
+		return index >= 0 ? table[index].val : (_Val)0;
 	}
 
 	/**
@@ -257,9 +279,6 @@ public:
 	 * @return The value in the table, if the key is found; otherwise 0
 	 */
 	_Val remove(_Key key) {
-		struct hashlistnode<_Key, _Val> *search;
-		struct hashlistnode<_Key, _Val> *replace;
-
 		/* HashTable cannot handle 0 as a key */
 		if (!key) {
 			if (!zero) {
@@ -273,52 +292,20 @@ public:
 			}
 		}
 
-
-		unsigned int index = hash_function(key);
-		do {
-			index &= capacitymask;
-			search = &table[index];
-			if (!search->key) {
-				if (!search->val)
-					break;
-			} else {
-				// The case where an item is found
-				if (equals(search->key, key)) {
-					unsigned int j = index;
-					_Val v = search->val;
-					size--;
-
-					// Idea: keep bins contiguous
-					while (true) {
-						search->val = 0;
-						search->key = 0;
-
-						while (true) {
-							j = (j + 1) & capacitymask;
-							replace = &table[j];
-
-							if (!replace->key && !replace->val) {
-								return v;
-							}
-
-							unsigned int hash = hash_function(replace->key) & capacitymask;
-							if (index <= j && index < hash && hash <= j)
-								continue;
-							else if (index > j && (index < hash || hash <= j) )
-								continue;
-							else
-								break;
-						}
-
-						table[index] = table[j];
-						index = j;
-						search = &table[index];
-					}
-				}
-			}
-			index++;
-		} while (true);
-		return (_Val)0;
+		int index = find(key, scramble(key));
+		if (index < 0)
+			return (_Val)0;
+		_Val v = table[index].val;
+		size--;
+		/* Probes stop at a group with an empty slot, so a slot in such a
+		 * group can become empty again without hiding any other key */
+		unsigned int group = index & ~(HT_GROUPWIDTH - 1);
+		if (HashGroup(&ctrl[group]).matchEmpty()) {
+			ctrl[index] = HT_EMPTY;
+			used--;
+		} else
+			ctrl[index] = HT_DELETED;
+		return v;
 	}
 
 	unsigned int getSize() const {
@@ -335,26 +322,12 @@ public:
 	 * @return True, if the key is found; false otherwise
 	 */
 	bool contains(_Key key) const {
-		struct hashlistnode<_Key, _Val> *search;
-
 		/* HashTable cannot handle 0 as a key */
 		if (!key) {
 			return zero!=NULL;
 		}
 
-		unsigned int index = hash_function(key);
-		do {
-			index &= capacitymask;
-			search = &table[index];
-			if (!search->key) {
-				if (!search->val)
-					break;
-			} else
-			if (equals(search->key, key))
-				return true;
-			index++;
-		} while (true);
-		return false;
+		return find(key, scramble(key)) >= 0;
 	}
 
 	/**
@@ -362,52 +335,111 @@ public:
 	 * @param newsize The new size of the table
 	 */
 	void resize(unsigned int newsize) {
+		uint8_t *oldctrl = ctrl;
 		struct hashlistnode<_Key, _Val> *oldtable = table;
-		struct hashlistnode<_Key, _Val> *newtable;
 		unsigned int oldcapacity = capacity;
 
-		if ((newtable = (struct hashlistnode<_Key, _Val> *)_calloc(newsize, sizeof(struct hashlistnode<_Key, _Val>))) == NULL) {
-			model_print("calloc error %s %d\n", __FILE__, __LINE__);
-			exit(EXIT_FAILURE);
-		}
+		allocate(newsize);
 
-		table = newtable;	// Update the global hashtable upon resize()
-		capacity = newsize;
-		capacitymask = newsize - 1;
-
-		threshold = (unsigned int)(newsize * loadfactor);
-
-		struct hashlistnode<_Key, _Val> *bin = &oldtable[0];
-		struct hashlistnode<_Key, _Val> *lastbin = &oldtable[oldcapacity];
-		for (;bin < lastbin;bin++) {
-			_Key key = bin->key;
-
-			struct hashlistnode<_Key, _Val> *search;
-			if (!key)
+		for (unsigned int i = 0;i < oldcapacity;i++) {
+			if (!(oldctrl[i] & HT_FULL))
 				continue;
-
-			unsigned int index = hash_function(key);
-			do {
-				index &= capacitymask;
-				search = &table[index];
-				index++;
-			} while (search->key);
-
-			search->key = key;
-			search->val = bin->val;
+			_Key key = oldtable[i].key;
+			uint64_t hash = scramble(key);
+			int index = findFree(hash);
+			ctrl[index] = h2(hash);
+			table[index].key = key;
+			table[index].val = oldtable[i].val;
+			used++;
 		}
 
-		_free(oldtable);	// Free the memory of the old hash table
+		_free(oldctrl);	// Free the memory of the old hash table
 	}
 	double getLoadFactor() {return loadfactor;}
 	unsigned int getCapacity() {return capacity;}
+	/** @brief The control byte of each slot; the slots follow them in the
+	 *  same allocation */
+	uint8_t *ctrl;
 	struct hashlistnode<_Key, _Val> *table;
 	struct hashlistnode<_Key, _Val> *zero;
 	unsigned int capacity;
 	unsigned int size;
 private:
-	unsigned int capacitymask;
+	/** Allocates empty slots for at least newsize entries.  The size, not
+	 *  counting the zero key, is left for the caller to restore. */
+	void allocate(unsigned int newsize) {
+		unsigned int newcapacity = HT_GROUPWIDTH;
+		while (newcapacity < newsize)
+			newcapacity <<= 1;
+
+		/* The control bytes take a multiple of HT_GROUPWIDTH bytes, so
+		 * the slots after them stay aligned */
+		ctrl = (uint8_t *)_calloc(newcapacity, 1 + sizeof(struct hashlistnode<_Key, _Val>));
+		if (ctrl == NULL) {
+			model_print("calloc error %s %d\n", __FILE__, __LINE__);
+			exit(EXIT_FAILURE);
+		}
+		table = (struct hashlistnode<_Key, _Val> *)(ctrl + newcapacity);
+
+		capacity = newcapacity;
+		groupmask = newcapacity / HT_GROUPWIDTH - 1;
+		threshold = (unsigned int)(newcapacity * loadfactor);
+		if (threshold >= newcapacity)
+			threshold = newcapacity - 1;
+		used = 0;
+	}
+
+	/** Multiplies the hash by 2^64 / phi, so that the high bits used to
+	 *  pick the group and the control byte depend on every key bit. */
+	static uint64_t scramble(_Key key) {
+		return (uint64_t)hash_function(key) * 0x9E3779B97F4A7C15ULL;
+	}
+
+	static uint8_t h2(uint64_t hash) {
+		return HT_FULL | (uint8_t)(hash >> 57);
+	}
+
+	unsigned int firstGroup(uint64_t hash) const {
+		return (unsigned int)(hash >> 32) & groupmask;
+	}
+
+	bool isFull(unsigned int index) const {
+		return ctrl[index] & HT_FULL;
+	}
+
+	/** @return The slot holding key, or -1 if there is none */
+	int find(_Key key, uint64_t hash) const {
+		uint8_t tag = h2(hash);
+		unsigned int group = firstGroup(hash);
+		for (unsigned int step = 1;;step++) {
+			unsigned int base = group * HT_GROUPWIDTH;
+			HashGroup g(&ctrl[base]);
+			for (unsigned int mask = g.match(tag);mask;mask &= mask - 1) {
+				unsigned int index = base + __builtin_ctz(mask);
+				if (equals(table[index].key, key))
+					return index;
+			}
+			if (g.matchEmpty() || step > groupmask)
+				return -1;
+			group = (group + step) & groupmask;
+		}
+	}
+
+	/** @return The first empty or deleted slot on the probe sequence */
+	int findFree(uint64_t hash) const {
+		unsigned int group = firstGroup(hash);
+		for (unsigned int step = 1;;step++) {
+			unsigned int mask = HashGroup(&ctrl[group * HT_GROUPWIDTH]).matchFree();
+			if (mask)
+				return group * HT_GROUPWIDTH + __builtin_ctz(mask);
+			group = (group + step) & groupmask;
+		}
+	}
+
+	unsigned int groupmask;
 	unsigned int threshold;
+	/** @brief Number of slots that are full or deleted */
+	unsigned int used;
 	double loadfactor;
 };
 
@@ -2,6 +2,8 @@
  *  @brief Entry point for the model checker.
  */
 
+#include <limits.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
@@ -24,7 +26,17 @@ void param_defaults(struct model_params *params)
 	params->traceminsize = 0;
 	params->checkthreshold = 500000;
 	params->removevisible = false;
+	params->gcmemory = 0;
 	params->nofork = false;
+	params->snapshot = SNAPSHOT_FORK;
+	params->workers = 1;
+	params->sharedmemory = SHARED_MEMORY_DEFAULT;
+	params->modelstack = STACK_SIZE_DEFAULT;
+	params->stacksize = STACK_SIZE >> 10;
+	params->shadowtables = SHADOWBASETABLES;
+	params->maxraces = 0;
+	params->sitebudget = 0;
+	params->racesample = 100;
 }
 
 static void print_usage(struct model_params *params)
@@ -55,15 +67,62 @@ static void print_usage(struct model_params *params)
 		"                            Default: %u\n"
 		"                            -o help for a list of options\n"
 		"-n                          No fork\n"
+		"-k, --snapshot=NAME         How to roll back between executions: fork runs\n"
+		"                            each execution in a child process; mprotect\n"
+		"                            restores the pages it wrote (experimental);\n"
+		"                            uffd has the kernel track written pages\n"
+		"                            (Linux 6.7 or later, experimental).\n"
+		"                            Default: fork\n",
+		params->verbose,
+		params->maxexecutions);
+	/* model_print() formats into a 2048 byte buffer */
+	model_print(
+		"-j, --workers=NUM           Number of executions to run at once, in as many\n"
+		"                            worker processes. Needs -k fork; not with -t.\n"
+		"                            Default: %u (1 to %u)\n"
+		"-M, --sharedmemory=NUM      Megabytes reserved for the model-checker's\n"
+		"                            shared heap; only what it uses is committed.\n"
+		"                            Default: %u (1 to %u)\n"
+		"-K, --modelstack=NUM        Megabytes of stack for the model-checker.\n"
+		"                            Default: %u (1 to %u)\n"
+		"-S, --stacksize=NUM         Kilobytes of stack for each user thread.\n"
+		"                            Default: %u (%u to %u)\n"
+		"-D, --shadowtables=NUM      Number of shadow tables the data race detector\n"
+		"                            preallocates.\n"
+		"                            Default: %u (1 to %u)\n",
+		params->workers, WORKERS_MAX,
+		params->sharedmemory, SHARED_MEMORY_MAX,
+		params->modelstack, STACK_SIZE_MAX,
+		params->stacksize, STACK_SIZE_MIN_KB, STACK_SIZE_MAX_KB,
+		params->shadowtables, SHADOWBASETABLES_MAX);
+	model_print(
 		"-m, --minsize=NUM           Minimum number of actions to keep\n"
 		"                            Default: %u\n"
 		"-f, --freqfree=NUM          Frequency to free actions\n"
 		"                            Default: %u\n"
-		"-r, --removevisible         Free visible writes\n",
-		params->verbose,
-		params->maxexecutions,
+		"-r, --removevisible         Free visible writes\n"
+		"-g, --gcmemory=NUM          Free actions whenever the model-checker's heap\n"
+		"                            has grown by about NUM megabytes since the last\n"
+		"                            collection, keeping the last -m actions, or\n"
+		"                            %u without -m.  Replaces the -f schedule.\n"
+		"                            0 disables.\n"
+		"                            Default: %u\n"
+		"-b, --racebudget=NUM        Maximum number of unique data races to report,\n"
+		"                            after which loads are no longer checked.\n"
+		"                            0 means no limit.\n"
+		"                            Default: %u\n"
+		"-s, --sitebudget=NUM        Maximum number of data races to report for each\n"
+		"                            access site. 0 means no limit.\n"
+		"                            Default: %u\n"
+		"-p, --racesample=NUM        Percentage of plain loads to check for data races.\n"
+		"                            Default: %u\n",
 		params->traceminsize,
-		params->checkthreshold);
+		params->checkthreshold,
+		GC_MINSIZE_DEFAULT,
+		params->gcmemory,
+		params->maxraces,
+		params->sitebudget,
+		params->racesample);
 	model_print("Analysis plugins:\n");
 	for(unsigned int i=0;i<registeredanalysis->size();i++) {
 		TraceAnalysis * analysis=(*registeredanalysis)[i];
@@ -87,17 +146,44 @@ bool install_plugin(char * name) {
 	return true;
 }
 
-void parse_options(struct model_params *params) {
-	const char *shortopts = "hrnt:o:x:v:m:f:";
+/** @brief Parse a numeric option into *value if it lies in [min, max]
+ *  @return False if the argument is not a number in range */
+static bool parse_bounded(const char *arg, long min, long max, unsigned int *value) {
+	char *end;
+	long val = strtol(arg, &end, 10);
+	if (end == arg || *end != 0 || val < min || val > max)
+		return false;
+	*value = val;
+	return true;
+}
+
+/**
+ * @brief Parse the options in the C11TESTER environment variable
+ * @param params The parameters to fill in
+ * @param memoryonly Only parse the sizes of the shared memory, which is set
+ * up before the model-checker and its plugins exist; ignore everything else
+ */
+static void parse_option_string(struct model_params *params, bool memoryonly) {
+	const char *shortopts = "hrnk:j:M:K:S:D:t:o:x:v:m:f:g:b:s:p:";
 	const struct option longopts[] = {
 		{"help", no_argument, NULL, 'h'},
 		{"removevisible", no_argument, NULL, 'r'},
+		{"snapshot", required_argument, NULL, 'k'},
+		{"workers", required_argument, NULL, 'j'},
+		{"sharedmemory", required_argument, NULL, 'M'},
+		{"modelstack", required_argument, NULL, 'K'},
+		{"stacksize", required_argument, NULL, 'S'},
+		{"shadowtables", required_argument, NULL, 'D'},
 		{"analysis", required_argument, NULL, 't'},
 		{"options", required_argument, NULL, 'o'},
 		{"maxexecutions", required_argument, NULL, 'x'},
 		{"verbose", optional_argument, NULL, 'v'},
 		{"minsize", required_argument, NULL, 'm'},
 		{"freqfree", required_argument, NULL, 'f'},
+		{"gcmemory", required_argument, NULL, 'g'},
+		{"racebudget", required_argument, NULL, 'b'},
+		{"sitebudget", required_argument, NULL, 's'},
+		{"racesample", required_argument, NULL, 'p'},
 		{0, 0, 0, 0}	/* Terminator */
 	};
 	int opt, longindex;
@@ -126,7 +212,11 @@ void parse_options(struct model_params *params) {
 		}
 	}
 
+	/* The other options are reported when they are parsed for real */
+	opterr = !memoryonly;
 	while (!error && (opt = getopt_long(argc, argv, shortopts, longopts, &longindex)) != -1) {
+		if (memoryonly && opt != 'M' && opt != 'K')
+			continue;
 		switch (opt) {
 		case 'h':
 			print_usage(params);
@@ -134,6 +224,36 @@ void parse_options(struct model_params *params) {
 		case 'n':
 			params->nofork = true;
 			break;
+		case 'k':
+			if (strcmp(optarg, "fork") == 0)
+				params->snapshot = SNAPSHOT_FORK;
+			else if (strcmp(optarg, "mprotect") == 0)
+				params->snapshot = SNAPSHOT_MPROTECT;
+			else if (strcmp(optarg, "uffd") == 0)
+				params->snapshot = SNAPSHOT_UFFD;
+			else
+				error = true;
+			break;
+		case 'j':
+			if (!parse_bounded(optarg, 1, WORKERS_MAX, &params->workers))
+				error = true;
+			break;
+		case 'M':
+			if (!parse_bounded(optarg, 1, SHARED_MEMORY_MAX, &params->sharedmemory))
+				error = true;
+			break;
+		case 'K':
+			if (!parse_bounded(optarg, 1, STACK_SIZE_MAX, &params->modelstack))
+				error = true;
+			break;
+		case 'S':
+			if (!parse_bounded(optarg, STACK_SIZE_MIN_KB, STACK_SIZE_MAX_KB, &params->stacksize))
+				error = true;
+			break;
+		case 'D':
+			if (!parse_bounded(optarg, 1, SHADOWBASETABLES_MAX, &params->shadowtables))
+				error = true;
+			break;
 		case 'x':
 			params->maxexecutions = atoi(optarg);
 			break;
@@ -153,6 +273,22 @@ void parse_options(struct model_params *params) {
 		case 'r':
 			params->removevisible = true;
 			break;
+		case 'g':
+			if (!parse_bounded(optarg, 0, GC_MEMORY_MAX, &params->gcmemory))
+				error = true;
+			break;
+		case 'b':
+			if (!parse_bounded(optarg, 0, INT_MAX, &params->maxraces))
+				error = true;
+			break;
+		case 's':
+			if (!parse_bounded(optarg, 0, INT_MAX, &params->sitebudget))
+				error = true;
+			break;
+		case 'p':
+			if (!parse_bounded(optarg, 0, 100, &params->racesample))
+				error = true;
+			break;
 		case 'o':
 		{
 			ModelVector<TraceAnalysis *> * analyses = getInstalledTraceAnalysis();
@@ -168,11 +304,38 @@ void parse_options(struct model_params *params) {
 
 	/* Special value to reset implementation as described by Linux man page.  */
 	optind = 0;
+	opterr = 1;
+
+	if (memoryonly) {
+		/* Keep the defaults; the error is reported by parse_options() */
+		if (error)
+			param_defaults(params);
+		return;
+	}
+
+	if (params->workers > 1 && (params->snapshot != SNAPSHOT_FORK || params->nofork))
+		error = true;
+	/* Each worker would only see its own executions in the analysis */
+	if (params->workers > 1 && getInstalledTraceAnalysis()->size() != 0)
+		error = true;
+	/* Like -f, collections keep at least the last -m actions */
+	if (params->gcmemory != 0 && params->traceminsize == 0)
+		params->traceminsize = GC_MINSIZE_DEFAULT;
 
 	if (error)
 		print_usage(params);
 }
 
+void parse_options(struct model_params *params) {
+	parse_option_string(params, false);
+}
+
+/** @brief Parse just the options that size the shared memory, before the
+ *  model-checker is created in it */
+void parse_memory_options(struct model_params *params) {
+	parse_option_string(params, true);
+}
+
 void install_trace_analyses(ModelExecution *execution) {
 	ModelVector<TraceAnalysis *> * installedanalysis=getInstalledTraceAnalysis();
 	for(unsigned int i=0;i<installedanalysis->size();i++) {
@@ -20,6 +20,7 @@
 #include "plugins.h"
 
 ModelChecker *model = NULL;
+struct worker_shared *worker_shared = NULL;
 int inside_model = 0;
 
 uint64_t get_nanotime()
@@ -39,6 +40,8 @@ void placeholder(void *) {
 #define SIGSTACKSIZE 65536
 static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
 {
+	if (snapshot_handle_fault(si))
+		return;
 	model_print("Segmentation fault at %p\n", si->si_addr);
 	model_print("For debugging, place breakpoint at: %s:%d\n",
 							__FILE__, __LINE__);
@@ -55,7 +58,9 @@ void install_handler() {
 	sigaltstack(&ss, NULL);
 	struct sigaction sa;
 	sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART | SA_ONSTACK;
-	sigemptyset(&sa.sa_mask);
+	/* Other handlers must not fault while the snapshotting handles a fault */
+	sigfillset(&sa.sa_mask);
+	sigdelset(&sa.sa_mask, SIGSEGV);
 	sa.sa_sigaction = mprot_handle_pf;
 
 	if (sigaction(SIGSEGV, &sa, NULL) == -1) {
@@ -82,6 +87,10 @@ ModelChecker::ModelChecker() :
 	execution(new ModelExecution(this, scheduler)),
 	execution_number(1),
 	curr_thread_num(MAIN_THREAD_ID),
+	gc_slack(0),
+	gc_trigger(0),
+	gc_last_end(0),
+	gc_execution(0),
 	trace_analyses(),
 	inspect_plugin(NULL)
 {
@@ -91,17 +100,19 @@ ModelChecker::ModelChecker() :
 							"Written by Weiyu Luo, Brian Norris, and Brian Demsky\n\n");
 	init_memory_ops();
 	real_memset(&stats,0,sizeof(struct execution_stats));
+	register_plugins();
+	execution->setParams(&params);
+	param_defaults(&params);
+	parse_options(&params);
+	/* Before the first thread is created */
+	set_thread_stack_size((size_t)params.stacksize << 10);
 	init_thread = new Thread(execution->get_next_id(), (thrd_t *) model_malloc(sizeof(thrd_t)), &placeholder, NULL, NULL);
 #ifdef TLS
 	init_thread->setTLS((char *)get_tls_addr());
 #endif
 	execution->add_thread(init_thread);
 	scheduler->set_current_thread(init_thread);
-	register_plugins();
-	execution->setParams(&params);
-	param_defaults(&params);
-	parse_options(&params);
-	initRaceDetector();
+	initRaceDetector(&params);
 	/* Configure output redirection for the model-checker */
 	install_handler();
 }
@@ -255,14 +266,42 @@ void ModelChecker::record_stats()
 		 */
 		//ASSERT(scheduler->all_threads_sleeping());
 	}
+	if (snapshot_peak_inuse() > stats.heap_peak)
+		stats.heap_peak = snapshot_peak_inuse();
+}
+
+static void print_execution_stats(const struct execution_stats *stats)
+{
+	model_print("Number of complete, bug-free executions: %d\n", stats->num_complete);
+	model_print("Number of buggy executions: %d\n", stats->num_buggy_executions);
+	model_print("Total executions: %d\n", stats->num_total);
 }
 
 /** @brief Print execution stats */
 void ModelChecker::print_stats() const
 {
-	model_print("Number of complete, bug-free executions: %d\n", stats.num_complete);
-	model_print("Number of buggy executions: %d\n", stats.num_buggy_executions);
-	model_print("Total executions: %d\n", stats.num_total);
+	print_execution_stats(&stats);
+}
+
+/** @brief Print the stats at the end of model-checking, of all workers */
+void ModelChecker::print_final_stats() const
+{
+	const struct execution_stats *final = worker_shared != NULL ? &worker_shared->stats : &stats;
+	model_print("******* Model-checking complete: *******\n");
+	print_execution_stats(final);
+	model_print("Peak shared heap: %zu KB of %u MB\n", final->shared_peak >> 10, params.sharedmemory);
+	/* Only rolling back in-process runs on the model-checker's stack */
+	if (params.snapshot != SNAPSHOT_FORK)
+		model_print("Peak model-checker stack: %zu KB of %u MB\n", final->stack_peak >> 10, params.modelstack);
+	model_print("Peak snapshotting heap: %zu KB\n", final->heap_peak >> 10);
+}
+
+/** @brief Raise *peak to at least value, with other workers doing the same */
+static void update_peak(size_t *peak, size_t value)
+{
+	size_t old = *peak;
+	while (old < value && !__atomic_compare_exchange_n(peak, &old, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
 }
 
 /**
@@ -292,13 +331,23 @@ void ModelChecker::print_execution(bool printbugs) const
 }
 
 /**
- * Queries the model-checker for more executions to explore and, if one
- * exists, resets the model-checker state to execute a new execution.
+ * @return The number of the next execution; parallel workers number their
+ * executions together
+ */
+int ModelChecker::claim_execution_number()
+{
+	if (worker_shared != NULL)
+		return __sync_add_and_fetch(&worker_shared->executions, 1);
+	return execution_number + 1;
+}
+
+/**
+ * Finishes the current execution and, if there are more executions to
+ * explore, resets the model-checker state to execute a new execution.
  *
- * @return If there are more executions to explore, return true. Otherwise,
- * return false.
+ * @param next_execution The number of the next execution
  */
-void ModelChecker::finish_execution(bool more_executions)
+void ModelChecker::finish_execution(int next_execution)
 {
 	DBG();
 	/* Is this execution a feasible execution that's worth bug-checking? */
@@ -320,9 +369,9 @@ void ModelChecker::finish_execution(bool more_executions)
 	else
 		clear_program_output();
 
-	execution_number ++;
+	execution_number = next_execution;
 
-	if (more_executions)
+	if (next_execution <= params.maxexecutions)
 		reset_to_initial_state();
 }
 
@@ -352,10 +401,58 @@ Thread * ModelChecker::get_thread(const ModelAction *act) const
 	return execution->get_thread(act);
 }
 
+/** @return The current monotonic time, in nanoseconds */
+static uint64_t gc_nanotime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Collects old actions once the snapshotting heap grows too much
+ *
+ * Collection is triggered when snapshot_inuse(), which counts objects on
+ * slab free lists as free, has grown by gc_slack bytes since the last
+ * collection (or the start of the execution), with gc_slack
+ * starting at the --gcmemory budget.  If a collection takes more than
+ * GC_MAX_OVERHEAD percent of the time spent running since the previous one,
+ * the slack is doubled so collections become rarer; otherwise it is halved
+ * again, down to the budget.  The slack carries over to later executions.
+ */
+void ModelChecker::collect_on_growth()
+{
+	size_t budget = ((size_t) params.gcmemory) << 20;
+	if (gc_slack == 0)
+		gc_slack = budget;
+	if (gc_execution != execution_number) {
+		/* The heap was rolled back since the trigger was set */
+		gc_execution = execution_number;
+		gc_trigger = snapshot_inuse() + gc_slack;
+		gc_last_end = gc_nanotime();
+		return;
+	}
+	if (snapshot_inuse() < gc_trigger)
+		return;
+
+	uint64_t start = gc_nanotime();
+	execution->collectActions();
+	uint64_t end = gc_nanotime();
+
+	if ((end - start) * 100 > (start - gc_last_end) * GC_MAX_OVERHEAD)
+		gc_slack <<= 1;
+	else if (gc_slack > budget)
+		gc_slack = (gc_slack >> 1) < budget ? budget : gc_slack >> 1;
+	gc_trigger = snapshot_inuse() + gc_slack;
+	gc_last_end = end;
+}
+
 void ModelChecker::startRunExecution(Thread *old) {
 	while (true) {
-		if (params.traceminsize != 0 &&
-				execution->get_curr_seq_num() > checkfree) {
+		if (params.gcmemory != 0)
+			collect_on_growth();
+		else if (params.traceminsize != 0 &&
+						 execution->get_curr_seq_num() > checkfree) {
 			checkfree += params.checkthreshold;
 			execution->collectActions();
 		}
@@ -431,12 +528,22 @@ void ModelChecker::finishRunExecution(Thread *old)
 	curr_thread_num = MAIN_THREAD_ID;
 
 	/** If we have more executions, we won't make it past this call. */
-	finish_execution(execution_number < params.maxexecutions);
+	finish_execution(claim_execution_number());
 
 
 	/** We finished the final execution.  Print stuff and exit. */
-	model_print("******* Model-checking complete: *******\n");
-	print_stats();
+	snapshot_shared_usage(&stats.shared_peak, &stats.stack_peak);
+	if (worker_shared != NULL) {
+		/* The process that started the workers prints the stats */
+		__sync_fetch_and_add(&worker_shared->stats.num_total, stats.num_total);
+		__sync_fetch_and_add(&worker_shared->stats.num_buggy_executions, stats.num_buggy_executions);
+		__sync_fetch_and_add(&worker_shared->stats.num_complete, stats.num_complete);
+		update_peak(&worker_shared->stats.shared_peak, stats.shared_peak);
+		update_peak(&worker_shared->stats.stack_peak, stats.stack_peak);
+		update_peak(&worker_shared->stats.heap_peak, stats.heap_peak);
+	} else {
+		print_final_stats();
+	}
 
 	/* Have the trace analyses dump their output. */
 	for (unsigned int i = 0;i < trace_analyses.size();i++)
@@ -540,7 +647,8 @@ void ModelChecker::startChecker() {
 
 	//reset random number generator state
 	//setstate(random_state);
-	seed = get_nanotime();
+	/* Parallel workers may start executions at the same time */
+	seed = get_nanotime() ^ ((uint64_t)execution_number << 40);
 	srandom(seed);
 
 	install_trace_analyses(get_execution());
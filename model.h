@@ -28,6 +28,30 @@ struct execution_stats {
 	int num_total;	/**< @brief Total number of executions */
 	int num_buggy_executions;	/** @brief Number of buggy executions */
 	int num_complete;	/**< @brief Number of feasible, non-buggy, complete executions */
+	size_t shared_peak;	/**< @brief Bytes of the shared heap used */
+	size_t stack_peak;	/**< @brief Bytes of the model-checker's stack used */
+	size_t heap_peak;	/**< @brief Most bytes an execution allocated from the snapshotting heap */
+};
+
+/** @brief Number of races that parallel workers can tell each other about */
+#define WORKER_RACESLOTS 4096
+
+/** @brief What the parallel workers (-j) share; each worker has its own copy
+ *  of the rest of the model-checker */
+struct worker_shared {
+	/** @brief The number of executions handed out so far */
+	int executions;
+	/** @brief The stats of the workers that finished */
+	struct execution_stats stats;
+	/** @brief Hashes of the races some worker reported; 0 is a free slot */
+	uint64_t races[WORKER_RACESLOTS];
+	/** @brief The number of races counted against the -b budget */
+	unsigned int numraces;
+	/** @brief Hashes of the access sites counted against the -s budget; 0 is
+	 *  a free slot */
+	uint64_t sites[WORKER_RACESLOTS];
+	/** @brief The number of races counted for each entry of sites */
+	unsigned int sitecounts[WORKER_RACESLOTS];
 };
 
 /** @brief The central structure for model-checking */
@@ -43,6 +67,7 @@ public:
 	ModelExecution * get_execution() { return execution; }
 
 	int get_execution_number() const { return execution_number; }
+	void set_execution_number(int number) { execution_number = number; }
 
 	Thread * get_thread(thread_id_t tid) const;
 	Thread * get_thread(const ModelAction *act) const;
@@ -62,6 +87,7 @@ public:
 	void startChecker();
 	Thread * getInitThread() {return init_thread;}
 	Scheduler * getScheduler() {return scheduler;}
+	void print_final_stats() const;
 	MEMALLOC
 private:
 	/** Snapshot id we return to restart. */
@@ -85,9 +111,22 @@ private:
 
 	modelclock_t checkfree;
 
+	void collect_on_growth();
+
+	/** @brief Heap growth allowed between two --gcmemory collections.  Kept
+	 *  here rather than in the execution, so that it survives rollback. */
+	size_t gc_slack;
+	/** @brief Snapshotting heap usage at which the next collection runs */
+	size_t gc_trigger;
+	/** @brief Time at which the previous collection finished */
+	uint64_t gc_last_end;
+	/** @brief The execution that gc_trigger and gc_last_end belong to */
+	int gc_execution;
+
 	unsigned int get_num_threads() const;
 
-	void finish_execution(bool moreexecutions);
+	int claim_execution_number();
+	void finish_execution(int next_execution);
 	bool should_terminate_execution();
 
 	Thread * get_next_thread();
@@ -109,7 +148,9 @@ private:
 
 extern int inside_model;
 extern ModelChecker *model;
+extern struct worker_shared *worker_shared;
 void parse_options(struct model_params *params);
+void parse_memory_options(struct model_params *params);
 void install_trace_analyses(ModelExecution *execution);
 void createModelIfNotExist();
 
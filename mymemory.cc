@@ -20,22 +20,54 @@ int nextRequest = 0;
 int howManyFreed = 0;
 mspace sStaticSpace = NULL;
 
+/** @brief Exit when the shared heap cannot satisfy an allocation; it does
+ *  not grow past the memory reserved for it */
+static void * shared_heap_full(void *ptr)
+{
+	if (ptr == NULL) {
+		model_print("OUT OF SHARED MEMORY.  Reserve more with --sharedmemory.\n");
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
 /** Non-snapshotting calloc for our use. */
 void *model_calloc(size_t count, size_t size)
 {
-	return mspace_calloc(sStaticSpace, count, size);
+	return shared_heap_full(mspace_calloc(sStaticSpace, count, size));
 }
 
 /** Non-snapshotting malloc for our use. */
 void *model_malloc(size_t size)
 {
-	return mspace_malloc(sStaticSpace, size);
+	return shared_heap_full(mspace_malloc(sStaticSpace, size));
 }
 
 /** Non-snapshotting malloc for our use. */
 void *model_realloc(void *ptr, size_t size)
 {
-	return mspace_realloc(sStaticSpace, ptr, size);
+	void *tmp = mspace_realloc(sStaticSpace, ptr, size);
+	return size == 0 ? tmp : shared_heap_full(tmp);
+}
+
+/** @brief Bytes currently allocated from the snapshotting heap.  Lives in
+ *  snapshotted memory, so it rolls back together with the heap. */
+static size_t snapshot_bytes = 0;
+
+/** @brief Most bytes allocated from the snapshotting heap at once in this
+ *  execution; rolls back like snapshot_bytes */
+static size_t snapshot_peak = 0;
+
+/** @brief Bytes of freed objects that SnapshotSlab free lists hold on to;
+ *  rolls back like snapshot_bytes */
+size_t snapshot_slab_free = 0;
+
+/** @brief Size of a chunk of the snapshotting heap.  This is the size
+ *  dlmalloc keeps in the word before the memory, without its flag bits (see
+ *  malloc.c); reading it inline is cheaper than mspace_usable_size(). */
+static inline size_t snapshot_chunk_bytes(void *mem)
+{
+	return ((size_t *)mem)[-1] & ~(size_t)7;
 }
 
 /** @brief Snapshotting malloc, for use by model-checker (not user progs) */
@@ -43,6 +75,9 @@ void * snapshot_malloc(size_t size)
 {
 	void *tmp = mspace_malloc(model_snapshot_space, size);
 	ASSERT(tmp);
+	snapshot_bytes += snapshot_chunk_bytes(tmp);
+	if (snapshot_bytes > snapshot_peak)
+		snapshot_peak = snapshot_bytes;
 	return tmp;
 }
 
@@ -51,23 +86,47 @@ void * snapshot_calloc(size_t count, size_t size)
 {
 	void *tmp = mspace_calloc(model_snapshot_space, count, size);
 	ASSERT(tmp);
+	snapshot_bytes += snapshot_chunk_bytes(tmp);
+	if (snapshot_bytes > snapshot_peak)
+		snapshot_peak = snapshot_bytes;
 	return tmp;
 }
 
 /** @brief Snapshotting realloc, for use by model-checker (not user progs) */
 void *snapshot_realloc(void *ptr, size_t size)
 {
+	if (ptr != NULL)
+		snapshot_bytes -= snapshot_chunk_bytes(ptr);
 	void *tmp = mspace_realloc(model_snapshot_space, ptr, size);
 	ASSERT(tmp);
+	snapshot_bytes += snapshot_chunk_bytes(tmp);
+	if (snapshot_bytes > snapshot_peak)
+		snapshot_peak = snapshot_bytes;
 	return tmp;
 }
 
 /** @brief Snapshotting free, for use by model-checker (not user progs) */
 void snapshot_free(void *ptr)
 {
+	if (ptr != NULL)
+		snapshot_bytes -= snapshot_chunk_bytes(ptr);
 	mspace_free(model_snapshot_space, ptr);
 }
 
+/** @return The number of bytes of the snapshotting heap in use: what was
+ *  allocated, less the objects waiting on SnapshotSlab free lists, which
+ *  never go back to the heap */
+size_t snapshot_inuse()
+{
+	return snapshot_bytes - snapshot_slab_free;
+}
+
+/** @return The most bytes allocated from the snapshotting heap at once */
+size_t snapshot_peak_inuse()
+{
+	return snapshot_peak;
+}
+
 /** Non-snapshotting free for our use. */
 void model_free(void *ptr)
 {
@@ -1,6 +1,19 @@
 #ifndef __PARAMS_H__
 #define __PARAMS_H__
 
+/** @brief How the model-checker returns to the initial state between
+ *  executions */
+enum snapshot_backend {
+	/** @brief Run each execution in a forked child process */
+	SNAPSHOT_FORK,
+	/** @brief Write-protect memory and restore the pages an execution
+	 *  wrote (see snapshot.cc) */
+	SNAPSHOT_MPROTECT,
+	/** @brief Let the kernel track written pages with userfaultfd
+	 *  write-protection, and restore them in place */
+	SNAPSHOT_UFFD
+};
+
 /**
  * Model checker parameter structure. Holds run-time configuration options for
  * the model checker.
@@ -8,9 +21,32 @@
 struct model_params {
 	int maxexecutions;
 	bool nofork;
+	enum snapshot_backend snapshot;
+	/** @brief Number of worker processes that run executions in parallel
+	 *  (fork snapshotting only) */
+	unsigned int workers;
+	/** @brief Memory reserved for the shared (non-snapshotting) heap, in
+	 *  megabytes */
+	unsigned int sharedmemory;
+	/** @brief Size of the model-checker's own stack, in megabytes */
+	unsigned int modelstack;
+	/** @brief Size of the stack of each user thread, in kilobytes */
+	unsigned int stacksize;
+	/** @brief Number of shadow tables the race detector preallocates */
+	unsigned int shadowtables;
 	modelclock_t traceminsize;
 	modelclock_t checkthreshold;
 	bool removevisible;
+	/** @brief Growth of the snapshotting heap, in megabytes, that
+	 *  triggers collecting old actions (0 = collect per -m/-f only) */
+	unsigned int gcmemory;
+
+	/** @brief Maximum number of unique races reported per run (0 = no limit) */
+	unsigned int maxraces;
+	/** @brief Maximum number of races reported per access site (0 = no limit) */
+	unsigned int sitebudget;
+	/** @brief Percentage of plain loads that are race checked */
+	unsigned int racesample;
 
 	/** @brief Verbosity (0 = quiet; 1 = noisy; 2 = noisier) */
 	int verbose;
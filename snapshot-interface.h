@@ -6,14 +6,20 @@
 #ifndef __SNAPINTERFACE_H
 #define __SNAPINTERFACE_H
 #include <ucontext.h>
+#include <signal.h>
 
 typedef unsigned int snapshot_id;
 typedef void (*VoidFuncPtr)();
 
 void snapshot_system_init(unsigned int numheappages);
+void snapshot_shared_usage(size_t *shared, size_t *stack);
 void startExecution();
 snapshot_id take_snapshot();
 void snapshot_roll_back(snapshot_id theSnapShot);
+bool snapshot_handle_fault(siginfo_t *si);
+
+/** @brief Signal that ends a helper thread when rolling back in-process */
+#define SNAPSHOT_KILLSIG SIGRTMAX
 
 
 #endif
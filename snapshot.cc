@@ -6,6 +6,14 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#endif
 
 #include "hashtable.h"
 #include "snapshot.h"
@@ -13,22 +21,28 @@
 #include "common.h"
 #include "context.h"
 #include "model.h"
+#include "params.h"
+#include "threads-model.h"
 
 
-#define SHARED_MEMORY_DEFAULT  (200 * ((size_t)1 << 20))	// 100mb for the shared memory
-#define STACK_SIZE_DEFAULT      (((size_t)1 << 20) * 20)	// 20 mb out of the above 100 mb for my stack
-
 struct fork_snapshotter {
 	/** @brief Pointer to the shared (non-snapshot) memory heap base
-	 * (NOTE: this has size SHARED_MEMORY_DEFAULT - sizeof(*fork_snap)) */
+	 * (NOTE: this has size mSharedSize - sizeof(*fork_snap)) */
 	void *mSharedMemoryBase;
 
+	/** @brief Size of the shared memory up to the shared stack */
+	size_t mSharedSize;
+
 	/** @brief Pointer to the shared (non-snapshot) stack region */
 	void *mStackBase;
 
 	/** @brief Size of the shared stack */
 	size_t mStackSize;
 
+	/** @brief The memfd behind the shared memory, which parallel workers
+	 *  copy; closed once the snapshot is taken */
+	int mSharedFd;
+
 	/**
 	 * @brief Stores the ID that we are attempting to roll back to
 	 *
@@ -90,10 +104,22 @@ static void fork_exit()
 	_Exit(EXIT_SUCCESS);
 }
 
-static void createSharedMemory()
+/**
+ * @brief Reserve the shared memory
+ *
+ * The memfd behind it is sparse and the mapping does not reserve swap, so a
+ * page is only committed when it is first touched; a big reservation costs
+ * nothing until the model-checker uses it.
+ */
+static void createSharedMemory(size_t sharedsize, size_t stacksize)
 {
 	//step 1. create shared memory.
-	void *memMapBase = mmap(0, SHARED_MEMORY_DEFAULT + STACK_SIZE_DEFAULT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	int fd = memfd_create("c11tester", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, sharedsize + stacksize) != 0) {
+		perror("memfd_create");
+		exit(EXIT_FAILURE);
+	}
+	void *memMapBase = mmap(0, sharedsize + stacksize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
 	if (memMapBase == MAP_FAILED) {
 		perror("mmap");
 		exit(EXIT_FAILURE);
@@ -102,8 +128,10 @@ static void createSharedMemory()
 	//Setup snapshot record at top of free region
 	fork_snap = (struct fork_snapshotter *)memMapBase;
 	fork_snap->mSharedMemoryBase = (void *)((uintptr_t)memMapBase + sizeof(*fork_snap));
-	fork_snap->mStackBase = (void *)((uintptr_t)memMapBase + SHARED_MEMORY_DEFAULT);
-	fork_snap->mStackSize = STACK_SIZE_DEFAULT;
+	fork_snap->mSharedSize = sharedsize;
+	fork_snap->mStackBase = (void *)((uintptr_t)memMapBase + sharedsize);
+	fork_snap->mStackSize = stacksize;
+	fork_snap->mSharedFd = fd;
 	fork_snap->mIDToRollback = -1;
 	fork_snap->currSnapShotID = 0;
 	sStaticSpace = create_shared_mspace();
@@ -117,28 +145,126 @@ static void createSharedMemory()
  */
 mspace create_shared_mspace()
 {
-	if (!fork_snap)
-		createSharedMemory();
-	return create_mspace_with_base((void *)(fork_snap->mSharedMemoryBase), SHARED_MEMORY_DEFAULT - sizeof(*fork_snap), 1);
+	size_t size = fork_snap->mSharedSize - sizeof(*fork_snap);
+	mspace space = create_mspace_with_base((void *)(fork_snap->mSharedMemoryBase), size, 1);
+	/* Fail once it is full, rather than mmap more memory that is private */
+	mspace_set_footprint_limit(space, size);
+	return space;
 }
 
-static void fork_snapshot_init(unsigned int numheappages)
+static void fork_snapshot_init(unsigned int numheappages, size_t sharedsize, size_t stacksize)
 {
 	if (!fork_snap)
-		createSharedMemory();
+		createSharedMemory(sharedsize, stacksize);
 
 	model_snapshot_space = create_mspace(numheappages * PAGESIZE, 1);
 }
 
+static void close_shared_fd()
+{
+	if (fork_snap->mSharedFd >= 0) {
+		close(fork_snap->mSharedFd);
+		fork_snap->mSharedFd = -1;
+	}
+}
+
+/** @brief Give this worker its own copy of the shared memory, so that it and
+ *  its executions do not share the model-checker with the other workers
+ *  @param sharedfd The memfd behind the shared memory; other workers may
+ *  still be copying it */
+static void fork_copy_shared_memory(int sharedfd)
+{
+	size_t size = fork_snap->mSharedSize + fork_snap->mStackSize;
+	char *base = (char *)fork_snap;
+	int fd = memfd_create("c11tester", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, size) != 0) {
+		perror("memfd_create");
+		exit(EXIT_FAILURE);
+	}
+	/* Only copy what was ever written; the rest stays a hole */
+	off_t start = 0;
+	while ((start = lseek(sharedfd, start, SEEK_DATA)) >= 0) {
+		off_t end = lseek(sharedfd, start, SEEK_HOLE);
+		while (start < end) {
+			ssize_t bytes = pwrite(fd, base + start, end - start, start);
+			if (bytes <= 0) {
+				perror("pwrite");
+				exit(EXIT_FAILURE);
+			}
+			start += bytes;
+		}
+	}
+	if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	close(sharedfd);
+	fork_snap->mSharedFd = -1;
+}
+
+/**
+ * @brief Split the executions among parallel worker processes (-j)
+ *
+ * Each worker runs its executions one at a time from its own copy of the
+ * shared memory, like a model-checker on its own; the workers only share
+ * the counters in worker_shared.  Returns in each worker, while the original
+ * process waits for them and prints the stats.
+ */
+static void fork_workers()
+{
+	unsigned int numworkers = model->params.workers;
+	if (numworkers > (unsigned int)model->params.maxexecutions)
+		numworkers = model->params.maxexecutions;
+	worker_shared = (struct worker_shared *)mmap(NULL, sizeof(struct worker_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (worker_shared == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	/* Each worker starts with one of the first executions */
+	worker_shared->executions = numworkers;
+
+	int sharedfd = fork_snap->mSharedFd;
+	for (unsigned int i = 0;i < numworkers;i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			fork_copy_shared_memory(sharedfd);
+			model->set_execution_number(i + 1);
+			return;
+		}
+		if (pid < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	close_shared_fd();
+	for (unsigned int i = 0;i < numworkers;) {
+		if (wait(NULL) >= 0)
+			i++;
+		else if (errno != EINTR) {
+			perror("wait");
+			exit(EXIT_FAILURE);
+		}
+	}
+	model->print_final_stats();
+	_Exit(EXIT_SUCCESS);
+}
+
 volatile int modellock = 0;
 
 static void fork_loop() {
 	/* switch back here when takesnapshot is called */
 	snapshotid = fork_snap->currSnapShotID;
 	if (model->params.nofork) {
+		close_shared_fd();
 		setcontext(&shared_ctxt);
 		_Exit(EXIT_SUCCESS);
 	}
+	if (model->params.workers > 1)
+		fork_workers();
+	else
+		close_shared_fd();
 
 	while (true) {
 		pid_t forkedID;
@@ -170,7 +296,7 @@ static void fork_loop() {
 
 static void fork_startExecution() {
 	/* switch to a new entryPoint context, on a new stack */
-	create_context(&private_ctxt, snapshot_calloc(STACK_SIZE_DEFAULT, 1), STACK_SIZE_DEFAULT, fork_loop);
+	create_context(&private_ctxt, snapshot_calloc(fork_snap->mStackSize, 1), fork_snap->mStackSize, fork_loop);
 }
 
 static snapshot_id fork_take_snapshot() {
@@ -187,17 +313,878 @@ static void fork_roll_back(snapshot_id theID)
 	fork_exit();
 }
 
+/* mprotect-based snapshotting
+ *
+ * Instead of forking for every execution, the model-checker stays in one
+ * process.  Taking the snapshot write-protects every private writable
+ * mapping; the first write to a page faults, and snapshot_handle_fault()
+ * copies the page aside before making it writable.  Rolling back copies
+ * those pages back, unmaps what was mapped since the snapshot, restores the
+ * file descriptors, and write-protects the pages again.  The real threads
+ * that backed user threads are killed rather than joined.
+ *
+ * The kernel does not fault on user memory it writes itself (e.g., read()
+ * into a buffer), but fails with EFAULT when the page is write-protected;
+ * the model-checker faults such buffers in before its own system calls.
+ */
+
+/** @brief Maximum number of writable mappings that are tracked */
+#define MPROT_MAXREGIONS 1024
+/** @brief Maximum number of mappings in the memory map */
+#define MPROT_MAXMAPPINGS 8192
+/** @brief Maximum number of file descriptors restored on rollback */
+#define MPROT_MAXFDS 64
+/** @brief Lowest descriptor used to keep the snapshot's descriptors open */
+#define MPROT_FDBASE 512
+/** @brief Number of pages, aligned, that are copied together on a fault */
+#define MPROT_FAULTPAGES 8
+/** @brief Size of the buffer for reading /proc */
+#define MPROT_READBUFSIZE 65536
+/** @brief Number of page ranges returned by one pagemap scan */
+#define MPROT_SCANRANGES 512
+
+/* Older kernel headers lack what the userfaultfd-based snapshotting uses */
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+#ifndef PAGEMAP_SCAN
+struct page_region {
+	uint64_t start;
+	uint64_t end;
+	uint64_t categories;
+};
+
+struct pm_scan_arg {
+	uint64_t size;
+	uint64_t flags;
+	uint64_t start;
+	uint64_t end;
+	uint64_t walk_end;
+	uint64_t vec;
+	uint64_t vec_len;
+	uint64_t max_pages;
+	uint64_t category_inverted;
+	uint64_t category_mask;
+	uint64_t category_anyof_mask;
+	uint64_t return_mask;
+};
+
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PAGE_IS_PRESENT (1 << 3)
+#define PAGE_IS_SWAPPED (1 << 4)
+#endif
+
+/** @brief A writable mapping whose pages are restored on rollback */
+struct mprot_region {
+	uintptr_t start;
+	uintptr_t end;
+	/** @brief Protection of the mapping at snapshot time */
+	int prot;
+	/** @brief Index of the first page in the dirty bitmap */
+	size_t firstpage;
+	/** @brief Whether the region must be write-protected again */
+	bool touched;
+};
+
+/** @brief An address range */
+struct mprot_range {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+/** @brief A page that was copied aside before it was first written */
+struct mprot_page {
+	uintptr_t addr;
+	unsigned int region;
+};
+
+struct mprot_snapshotter {
+	/** @brief The tracked mappings, sorted by address */
+	struct mprot_region regions[MPROT_MAXREGIONS];
+	unsigned int numregions;
+
+	/** @brief Every mapping at snapshot time, sorted and coalesced */
+	struct mprot_range mappings[MPROT_MAXMAPPINGS];
+	unsigned int nummappings;
+
+	/** @brief The mappings at rollback time; scratch space for restoring */
+	struct mprot_range current[MPROT_MAXMAPPINGS];
+	unsigned int numcurrent;
+
+	/** @brief The program break at snapshot time */
+	uintptr_t brk;
+
+	/** @brief The descriptors open at snapshot time, their flags, and
+	 *  the duplicates that keep them open */
+	int fds[MPROT_MAXFDS];
+	int fdflags[MPROT_MAXFDS];
+	int savedfds[MPROT_MAXFDS];
+	unsigned int numfds;
+
+	/** @brief Pages that are always restored, because they must stay
+	 *  writable: the lowest page of the main stack (so the stack grows
+	 *  writable), and the thread's rseq area, which the kernel updates */
+	uintptr_t pinned[2];
+	unsigned int pinnedregion[2];
+	unsigned int numpinned;
+
+	/** @brief One bit per tracked page; set once the page was copied */
+	uint64_t *dirty;
+	/** @brief The copied pages, in the order they were first written;
+	 *  with -k uffd, the backing is indexed like the bitmap instead */
+	struct mprot_page *pages;
+	char *backing;
+	size_t numdirty;
+
+	/** @brief With -k uffd, the userfaultfd and /proc/self/pagemap;
+	 *  otherwise -1 */
+	int uffd;
+	int pagemap;
+	struct page_region scan[MPROT_SCANRANGES];
+
+	volatile int lock;
+	bool taken;
+	ucontext_t restore_ctxt;
+	char readbuf[MPROT_READBUFSIZE];
+};
+
+static struct mprot_snapshotter *mprot_snap = NULL;
+
+static uintptr_t mprot_parse_hex(const char **p)
+{
+	uintptr_t val = 0;
+	while (true) {
+		char c = **p;
+		if (c >= '0' && c <= '9')
+			val = (val << 4) | (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			val = (val << 4) | (c - 'a' + 10);
+		else
+			return val;
+		(*p)++;
+	}
+}
+
+/**
+ * @brief Call a function for each line of /proc/self/maps
+ *
+ * Reads with plain system calls into mprot_snap->readbuf, since it also
+ * runs while rolling back, when nothing may be allocated.
+ */
+static void mprot_scan_maps(void (*func)(uintptr_t start, uintptr_t end, const char *perms, const char *line))
+{
+	int fd = open("/proc/self/maps", O_RDONLY);
+	if (fd < 0) {
+		perror("open /proc/self/maps");
+		exit(EXIT_FAILURE);
+	}
+	char *buf = mprot_snap->readbuf;
+	size_t len = 0;
+	while (true) {
+		ssize_t bytes = read(fd, buf + len, MPROT_READBUFSIZE - 1 - len);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read /proc/self/maps");
+			exit(EXIT_FAILURE);
+		}
+		len += bytes;
+		buf[len] = 0;
+		char *line = buf;
+		char *eol;
+		while ((eol = strchr(line, '\n')) != NULL) {
+			*eol = 0;
+			const char *p = line;
+			uintptr_t start = mprot_parse_hex(&p);
+			p++;
+			uintptr_t end = mprot_parse_hex(&p);
+			p++;
+			func(start, end, p, line);
+			line = eol + 1;
+		}
+		len = buf + len - line;
+		real_memmove(buf, line, len);
+		if (bytes == 0)
+			break;
+	}
+	close(fd);
+}
+
+/** @brief Append a range to a sorted list, merging it with the last one if
+ *  they are adjacent */
+static void mprot_append_range(struct mprot_range *list, unsigned int *num, uintptr_t start, uintptr_t end)
+{
+	if (*num > 0 && list[*num - 1].end == start) {
+		list[*num - 1].end = end;
+		return;
+	}
+	if (*num == MPROT_MAXMAPPINGS) {
+		model_print("Too many mappings for mprotect snapshotting\n");
+		exit(EXIT_FAILURE);
+	}
+	list[*num].start = start;
+	list[*num].end = end;
+	(*num)++;
+}
+
+static void mprot_add_region(uintptr_t start, uintptr_t end, int prot)
+{
+	if (start >= end)
+		return;
+	if (mprot_snap->numregions == MPROT_MAXREGIONS) {
+		model_print("Too many writable mappings for mprotect snapshotting\n");
+		exit(EXIT_FAILURE);
+	}
+	struct mprot_region *region = &mprot_snap->regions[mprot_snap->numregions++];
+	region->start = start;
+	region->end = end;
+	region->prot = prot;
+	region->touched = false;
+}
+
+/** @brief Track a mapping, unless it is shared, not readable and writable,
+ *  or the snapshotter's own state */
+static void mprot_record_region(uintptr_t start, uintptr_t end, const char *perms, const char *line)
+{
+	if (perms[0] != 'r' || perms[1] != 'w' || perms[3] != 'p')
+		return;
+	int prot = PROT_READ | PROT_WRITE | (perms[2] == 'x' ? PROT_EXEC : 0);
+	uintptr_t self = (uintptr_t)mprot_snap;
+	uintptr_t selfend = self + ((sizeof(*mprot_snap) + PAGESIZE - 1) & ~((uintptr_t)PAGESIZE - 1));
+	if (start < selfend && self < end) {
+		/* The kernel may have merged our state with a neighbour */
+		mprot_add_region(start, self, prot);
+		mprot_add_region(selfend, end, prot);
+	} else {
+		mprot_add_region(start, end, prot);
+	}
+	if (strstr(line, "[stack]") != NULL) {
+		unsigned int index = mprot_snap->numregions - 1;
+		mprot_snap->pinned[mprot_snap->numpinned] = mprot_snap->regions[index].start;
+		mprot_snap->pinnedregion[mprot_snap->numpinned++] = index;
+	}
+}
+
+static void mprot_record_mapping(uintptr_t start, uintptr_t end, const char *perms, const char *line)
+{
+	mprot_append_range(mprot_snap->mappings, &mprot_snap->nummappings, start, end);
+}
+
+static void mprot_record_current(uintptr_t start, uintptr_t end, const char *perms, const char *line)
+{
+	mprot_append_range(mprot_snap->current, &mprot_snap->numcurrent, start, end);
+}
+
+/** @return The index of the tracked region containing addr, or -1 */
+static int mprot_find_region(uintptr_t addr)
+{
+	int low = 0, high = mprot_snap->numregions - 1;
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		if (addr < mprot_snap->regions[mid].start)
+			high = mid - 1;
+		else if (addr >= mprot_snap->regions[mid].end)
+			low = mid + 1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+static void * mprot_map(size_t size)
+{
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	return mem;
+}
+
+/** @brief Copy a tracked page aside, unless it already was */
+static void mprot_copy_page(uintptr_t page, unsigned int index)
+{
+	struct mprot_region *region = &mprot_snap->regions[index];
+	size_t bit = region->firstpage + (page - region->start) / PAGESIZE;
+	if (mprot_snap->dirty[bit / 64] & (1ULL << (bit % 64)))
+		return;
+	size_t slot = mprot_snap->numdirty;
+	real_memcpy(mprot_snap->backing + slot * PAGESIZE, (void *)page, PAGESIZE);
+	mprot_snap->pages[slot].addr = page;
+	mprot_snap->pages[slot].region = index;
+	mprot_snap->numdirty = slot + 1;
+	mprot_snap->dirty[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static void mprot_unprotect(uintptr_t start, uintptr_t end, unsigned int index)
+{
+	if (mprotect((void *)start, end - start, mprot_snap->regions[index].prot) != 0) {
+		perror("mprotect");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** @brief Copy a tracked page aside and make it writable */
+static void mprot_dirty_page(uintptr_t addr, unsigned int index)
+{
+	uintptr_t page = addr & ~((uintptr_t)PAGESIZE - 1);
+	mprot_copy_page(page, index);
+	mprot_unprotect(page, page + PAGESIZE, index);
+}
+
+static void mprot_protect_range(uintptr_t start, uintptr_t end, int prot)
+{
+	if (start < end && mprotect((void *)start, end - start, prot & ~PROT_WRITE) != 0) {
+		perror("mprotect");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** @brief Write-protect a region, except for its pinned pages, which are
+ *  never protected even briefly: the kernel updates the rseq area whenever
+ *  it delivers a signal */
+static void mprot_protect_region(unsigned int index)
+{
+	struct mprot_region *region = &mprot_snap->regions[index];
+	uintptr_t start = region->start;
+	for (unsigned int i = 0;i < mprot_snap->numpinned;i++) {
+		if (mprot_snap->pinnedregion[i] != index)
+			continue;
+		mprot_protect_range(start, mprot_snap->pinned[i], region->prot);
+		start = mprot_snap->pinned[i] + PAGESIZE;
+	}
+	mprot_protect_range(start, region->end, region->prot);
+}
+
+/** @brief Copy the pinned pages aside; they stay writable */
+static void mprot_pin_pages()
+{
+	for (unsigned int i = 0;i < mprot_snap->numpinned;i++)
+		mprot_dirty_page(mprot_snap->pinned[i], mprot_snap->pinnedregion[i]);
+}
+
+bool snapshot_handle_fault(siginfo_t *si)
+{
+	if (mprot_snap == NULL || !mprot_snap->taken || mprot_snap->uffd >= 0 || si->si_code != SEGV_ACCERR)
+		return false;
+	uintptr_t addr = (uintptr_t)si->si_addr;
+	int index = mprot_find_region(addr);
+	if (index < 0)
+		return false;
+	/* Writes cluster, so take the neighbouring pages along */
+	struct mprot_region *region = &mprot_snap->regions[index];
+	uintptr_t start = addr & ~((uintptr_t)MPROT_FAULTPAGES * PAGESIZE - 1);
+	uintptr_t end = start + MPROT_FAULTPAGES * PAGESIZE;
+	if (start < region->start)
+		start = region->start;
+	if (end > region->end)
+		end = region->end;
+	while (__sync_lock_test_and_set(&mprot_snap->lock, 1))
+		;
+	for (uintptr_t page = start;page < end;page += PAGESIZE)
+		mprot_copy_page(page, index);
+	mprot_unprotect(start, end, index);
+	__sync_lock_release(&mprot_snap->lock);
+	return true;
+}
+
+/** @brief Handler for SNAPSHOT_KILLSIG: end this real thread right away */
+static void mprot_exit_thread(int sig)
+{
+	syscall(SYS_exit, 0);
+}
+
+/* userfaultfd-based snapshotting
+ *
+ * The same process and the same rollback as above, but the kernel tracks
+ * which pages were written: the tracked regions are registered for
+ * asynchronous userfaultfd write-protection, which resolves write faults in
+ * the kernel and only clears the page's write-protection.  Taking the
+ * snapshot copies every populated page aside.  Rolling back asks the pagemap
+ * for the pages without write-protection, copies them back (or drops the
+ * ones that were not populated), and write-protects them again.  Writes by
+ * the kernel are tracked too.  Needs Linux 6.7 for UFFD_FEATURE_WP_ASYNC
+ * and PAGEMAP_SCAN.
+ */
+
+static void uffd_open()
+{
+	struct uffdio_api api;
+	api.api = UFFD_API;
+	api.features = UFFD_FEATURE_WP_ASYNC;
+	int uffd = syscall(SYS_userfaultfd, O_CLOEXEC | UFFD_USER_MODE_ONLY);
+	if (uffd < 0 || ioctl(uffd, UFFDIO_API, &api) != 0) {
+		perror("userfaultfd");
+		model_print("-k uffd needs Linux 6.7 or later; try -k mprotect\n");
+		exit(EXIT_FAILURE);
+	}
+	mprot_snap->uffd = uffd;
+	mprot_snap->pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	if (mprot_snap->pagemap < 0) {
+		perror("open /proc/self/pagemap");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void uffd_register(uintptr_t start, uintptr_t end)
+{
+	struct uffdio_register reg;
+	reg.range.start = start;
+	reg.range.len = end - start;
+	reg.mode = UFFDIO_REGISTER_MODE_WP;
+	if (ioctl(mprot_snap->uffd, UFFDIO_REGISTER, &reg) != 0) {
+		perror("UFFDIO_REGISTER");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void uffd_protect(uintptr_t start, uintptr_t end)
+{
+	struct uffdio_writeprotect wp;
+	wp.range.start = start;
+	wp.range.len = end - start;
+	wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+	if (ioctl(mprot_snap->uffd, UFFDIO_WRITEPROTECT, &wp) != 0) {
+		perror("UFFDIO_WRITEPROTECT");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Find the pages in [start, end) that are in all of the required
+ * categories and in any of the others; the ranges go to mprot_snap->scan,
+ * split by whether the pages are populated
+ * @param walkend Where the scan stopped, because the ranges ran out
+ * @return The number of ranges found
+ */
+static long uffd_scan(uintptr_t start, uintptr_t end, uint64_t required, uint64_t anyof, uintptr_t *walkend)
+{
+	struct pm_scan_arg arg;
+	arg.size = sizeof(arg);
+	arg.flags = 0;
+	arg.start = start;
+	arg.end = end;
+	arg.walk_end = 0;
+	arg.vec = (uintptr_t)mprot_snap->scan;
+	arg.vec_len = MPROT_SCANRANGES;
+	arg.max_pages = 0;
+	arg.category_inverted = 0;
+	arg.category_mask = required;
+	arg.category_anyof_mask = anyof;
+	arg.return_mask = PAGE_IS_PRESENT | PAGE_IS_SWAPPED;
+	long num = ioctl(mprot_snap->pagemap, PAGEMAP_SCAN, &arg);
+	if (num < 0) {
+		perror("PAGEMAP_SCAN");
+		exit(EXIT_FAILURE);
+	}
+	*walkend = arg.walk_end;
+	return num;
+}
+
+/** @return The first page in [page, end) that was copied aside (or was not,
+ *  if saved is false), or end */
+static uintptr_t uffd_find_page(struct mprot_region *region, uintptr_t page, uintptr_t end, bool saved)
+{
+	size_t bit = region->firstpage + (page - region->start) / PAGESIZE;
+	size_t endbit = region->firstpage + (end - region->start) / PAGESIZE;
+	uint64_t flip = saved ? 0 : ~0ULL;
+	while (bit < endbit) {
+		uint64_t word = (mprot_snap->dirty[bit / 64] ^ flip) >> (bit % 64);
+		if (word != 0) {
+			bit += __builtin_ctzll(word);
+			break;
+		}
+		bit = (bit / 64 + 1) * 64;
+	}
+	if (bit >= endbit)
+		return end;
+	return region->start + (bit - region->firstpage) * PAGESIZE;
+}
+
+/** @brief Copy aside and write-protect the pages that are populated.  The
+ *  others are left alone, since write-protecting them would build page
+ *  tables for all of the (mostly unused) tracked memory, which each rollback
+ *  then has to scan; the pagemap reports them as written anyway. */
+static void uffd_take_snapshot()
+{
+	for (unsigned int i = 0;i < mprot_snap->numregions;i++) {
+		struct mprot_region *region = &mprot_snap->regions[i];
+		uffd_register(region->start, region->end);
+		uintptr_t start = region->start;
+		while (start < region->end) {
+			long num = uffd_scan(start, region->end, 0, PAGE_IS_PRESENT | PAGE_IS_SWAPPED, &start);
+			for (long j = 0;j < num;j++) {
+				uffd_protect(mprot_snap->scan[j].start, mprot_snap->scan[j].end);
+				for (uintptr_t page = mprot_snap->scan[j].start;page < mprot_snap->scan[j].end;page += PAGESIZE) {
+					size_t bit = region->firstpage + (page - region->start) / PAGESIZE;
+					real_memcpy(mprot_snap->backing + bit * PAGESIZE, (void *)page, PAGESIZE);
+					mprot_snap->dirty[bit / 64] |= 1ULL << (bit % 64);
+				}
+			}
+		}
+	}
+}
+
+/** @brief Return [start, end) of a region to the snapshot: copy back the
+ *  pages that were copied aside and write-protect them again, and drop the
+ *  others if they are populated */
+static void uffd_restore_range(struct mprot_region *region, uintptr_t start, uintptr_t end, bool populated)
+{
+	uintptr_t page = start;
+	while (page < end) {
+		uintptr_t run = uffd_find_page(region, page, end, true);
+		if (populated && page < run)
+			madvise((void *)page, run - page, MADV_DONTNEED);
+		if (run == end)
+			break;
+		page = uffd_find_page(region, run, end, false);
+		for (uintptr_t copy = run;copy < page;copy += PAGESIZE) {
+			size_t bit = region->firstpage + (copy - region->start) / PAGESIZE;
+			real_memcpy((void *)copy, mprot_snap->backing + bit * PAGESIZE, PAGESIZE);
+		}
+		uffd_protect(run, page);
+	}
+}
+
+/** @brief Return the written pages to the snapshot; runs after
+ *  mprot_restore_mappings() */
+static void uffd_restore()
+{
+	for (unsigned int i = 0;i < mprot_snap->numregions;i++) {
+		struct mprot_region *region = &mprot_snap->regions[i];
+		if (region->touched) {
+			/* Holes were mapped again: register them, and put back
+			 * the pages they lost */
+			region->touched = false;
+			uffd_register(region->start, region->end);
+			uffd_restore_range(region, region->start, region->end, false);
+		}
+		uintptr_t start = region->start;
+		while (start < region->end) {
+			long num = uffd_scan(start, region->end, PAGE_IS_WRITTEN, 0, &start);
+			for (long j = 0;j < num;j++) {
+				struct page_region *range = &mprot_snap->scan[j];
+				uffd_restore_range(region, range->start, range->end, range->categories != 0);
+			}
+		}
+	}
+}
+
+static void mprot_snapshot_init()
+{
+	mprot_snap = (struct mprot_snapshotter *)mprot_map(sizeof(*mprot_snap));
+	mprot_snap->uffd = -1;
+	mprot_snap->pagemap = -1;
+	close_shared_fd();
+	/* Before the descriptors are recorded, so rollback keeps these open */
+	if (model->params.snapshot == SNAPSHOT_UFFD)
+		uffd_open();
+
+	mprot_scan_maps(mprot_record_region);
+	size_t numpages = 0;
+	for (unsigned int i = 0;i < mprot_snap->numregions;i++) {
+		struct mprot_region *region = &mprot_snap->regions[i];
+		region->firstpage = numpages;
+		numpages += (region->end - region->start) / PAGESIZE;
+	}
+	mprot_snap->dirty = (uint64_t *)mprot_map((numpages / 64 + 1) * sizeof(uint64_t));
+	mprot_snap->pages = (struct mprot_page *)mprot_map(numpages * sizeof(struct mprot_page));
+	mprot_snap->backing = (char *)mprot_map(numpages * PAGESIZE);
+#if __has_include(<sys/rseq.h>)
+	if (__rseq_size != 0) {
+		uintptr_t rseq = (uintptr_t)__builtin_thread_pointer() + __rseq_offset;
+		int index = mprot_find_region(rseq);
+		if (index >= 0) {
+			mprot_snap->pinned[mprot_snap->numpinned] = rseq & ~((uintptr_t)PAGESIZE - 1);
+			mprot_snap->pinnedregion[mprot_snap->numpinned++] = index;
+		}
+	}
+#endif
+	/* mprot_protect_region() expects them in address order */
+	if (mprot_snap->numpinned == 2 && mprot_snap->pinned[1] < mprot_snap->pinned[0]) {
+		uintptr_t addr = mprot_snap->pinned[0];
+		unsigned int index = mprot_snap->pinnedregion[0];
+		mprot_snap->pinned[0] = mprot_snap->pinned[1];
+		mprot_snap->pinnedregion[0] = mprot_snap->pinnedregion[1];
+		mprot_snap->pinned[1] = addr;
+		mprot_snap->pinnedregion[1] = index;
+	}
+	mprot_snap->brk = syscall(SYS_brk, 0);
+	/* After our own mappings exist, so they are not unmapped on rollback */
+	mprot_scan_maps(mprot_record_mapping);
+
+	for (int fd = 0;fd < MPROT_FDBASE;fd++) {
+		int flags = fcntl(fd, F_GETFD);
+		if (flags < 0)
+			continue;
+		if (mprot_snap->numfds == MPROT_MAXFDS) {
+			model_print("Too many open files for mprotect snapshotting\n");
+			exit(EXIT_FAILURE);
+		}
+		int saved = fcntl(fd, F_DUPFD_CLOEXEC, MPROT_FDBASE);
+		if (saved < 0) {
+			perror("fcntl");
+			exit(EXIT_FAILURE);
+		}
+		mprot_snap->fds[mprot_snap->numfds] = fd;
+		mprot_snap->fdflags[mprot_snap->numfds] = flags;
+		mprot_snap->savedfds[mprot_snap->numfds++] = saved;
+	}
+
+	struct sigaction sa;
+	sa.sa_flags = SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = mprot_exit_thread;
+	if (sigaction(SNAPSHOT_KILLSIG, &sa, NULL) == -1) {
+		perror("sigaction");
+		exit(EXIT_FAILURE);
+	}
+	/* Bind what the fault and signal handlers call while everything is
+	 * still writable */
+	siginfo_t si;
+	si.si_code = 0;
+	snapshot_handle_fault(&si);
+	syscall(SYS_gettid);
+}
+
+static snapshot_id mprot_take_snapshot()
+{
+	if (!mprot_snap)
+		mprot_snapshot_init();
+	getcontext(&shared_ctxt);
+	if (!mprot_snap->taken) {
+		mprot_snap->taken = true;
+		if (mprot_snap->uffd >= 0) {
+			uffd_take_snapshot();
+		} else {
+			mprot_pin_pages();
+			for (unsigned int i = 0;i < mprot_snap->numregions;i++)
+				mprot_protect_region(i);
+		}
+	}
+	return 0;
+}
+
+/** @brief Wait until the killed helper threads are gone, so their stacks
+ *  can be unmapped */
+static void mprot_wait_for_threads()
+{
+	struct dirent64_hdr {
+		uint64_t ino;
+		int64_t off;
+		unsigned short reclen;
+		unsigned char type;
+		char name[];
+	};
+	while (true) {
+		int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY);
+		if (fd < 0) {
+			perror("open /proc/self/task");
+			exit(EXIT_FAILURE);
+		}
+		unsigned int numthreads = 0;
+		long bytes;
+		while ((bytes = syscall(SYS_getdents64, fd, mprot_snap->readbuf, MPROT_READBUFSIZE)) > 0) {
+			for (long pos = 0;pos < bytes;) {
+				struct dirent64_hdr *entry = (struct dirent64_hdr *)(mprot_snap->readbuf + pos);
+				if (entry->name[0] != '.')
+					numthreads++;
+				pos += entry->reclen;
+			}
+		}
+		close(fd);
+		if (numthreads <= 1)
+			return;
+		syscall(SYS_sched_yield);
+	}
+}
+
+/** @brief Close descriptors opened since the snapshot and point the
+ *  snapshot's descriptors back at their files */
+static void mprot_restore_fds()
+{
+	unsigned int next = 0;
+	for (unsigned int i = 0;i < mprot_snap->numfds;i++) {
+		unsigned int fd = mprot_snap->fds[i];
+		if (fd > next)
+			syscall(SYS_close_range, next, fd - 1, 0);
+		next = fd + 1;
+	}
+	for (unsigned int i = 0;i < mprot_snap->numfds;i++) {
+		unsigned int fd = mprot_snap->savedfds[i];
+		if (fd > next)
+			syscall(SYS_close_range, next, fd - 1, 0);
+		next = fd + 1;
+	}
+	syscall(SYS_close_range, next, ~0U, 0);
+	for (unsigned int i = 0;i < mprot_snap->numfds;i++) {
+		dup2(mprot_snap->savedfds[i], mprot_snap->fds[i]);
+		fcntl(mprot_snap->fds[i], F_SETFD, mprot_snap->fdflags[i]);
+	}
+}
+
+/** @brief Unmap what was mapped since the snapshot, and map tracked memory
+ *  that was unmapped again (it comes back zeroed, except for copied pages) */
+static void mprot_restore_mappings()
+{
+	mprot_snap->numcurrent = 0;
+	mprot_scan_maps(mprot_record_current);
+
+	/* Walk the current and snapshot-time mappings in order */
+	unsigned int j = 0;
+	for (unsigned int i = 0;i < mprot_snap->numcurrent;i++) {
+		uintptr_t start = mprot_snap->current[i].start, end = mprot_snap->current[i].end;
+		while (start < end) {
+			while (j < mprot_snap->nummappings && mprot_snap->mappings[j].end <= start)
+				j++;
+			uintptr_t newend = end;
+			if (j < mprot_snap->nummappings && mprot_snap->mappings[j].start <= start) {
+				start = mprot_snap->mappings[j].end;
+				continue;
+			}
+			if (j < mprot_snap->nummappings && mprot_snap->mappings[j].start < end)
+				newend = mprot_snap->mappings[j].start;
+			/* Includes where the main stack grew; it grows again from
+			 * its lowest page, which stays writable */
+			munmap((void *)start, newend - start);
+			start = newend;
+		}
+	}
+
+	j = 0;
+	for (unsigned int i = 0;i < mprot_snap->numregions;i++) {
+		struct mprot_region *region = &mprot_snap->regions[i];
+		uintptr_t start = region->start;
+		while (start < region->end) {
+			while (j < mprot_snap->numcurrent && mprot_snap->current[j].end <= start)
+				j++;
+			if (j < mprot_snap->numcurrent && mprot_snap->current[j].start <= start) {
+				start = mprot_snap->current[j].end;
+				continue;
+			}
+			uintptr_t end = region->end;
+			if (j < mprot_snap->numcurrent && mprot_snap->current[j].start < end)
+				end = mprot_snap->current[j].start;
+			if (mmap((void *)start, end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+				perror("mmap");
+				exit(EXIT_FAILURE);
+			}
+			region->touched = true;
+			start = end;
+		}
+	}
+}
+
+/** @brief Return memory to the snapshot; runs on the shared stack */
+static void mprot_restore()
+{
+#ifdef TLS
+	kill_helper_threads(SNAPSHOT_KILLSIG);
+#endif
+	mprot_wait_for_threads();
+	mprot_restore_fds();
+	/* Shrink the heap through the kernel, whose idea of the break would
+	 * otherwise disagree with the restored malloc */
+	syscall(SYS_brk, mprot_snap->brk);
+
+	if (mprot_snap->uffd >= 0) {
+		mprot_restore_mappings();
+		uffd_restore();
+		setcontext(&shared_ctxt);
+	}
+
+	/* Make written regions writable as a whole, which also merges the
+	 * mappings the per-page protections split them into */
+	for (size_t i = 0;i < mprot_snap->numdirty;i++)
+		mprot_snap->regions[mprot_snap->pages[i].region].touched = true;
+	for (unsigned int i = 0;i < mprot_snap->numregions;i++) {
+		struct mprot_region *region = &mprot_snap->regions[i];
+		if (region->touched)
+			mprotect((void *)region->start, region->end - region->start, region->prot);
+	}
+	mprot_restore_mappings();
+
+	for (size_t i = 0;i < mprot_snap->numdirty;i++) {
+		struct mprot_page *page = &mprot_snap->pages[i];
+		struct mprot_region *region = &mprot_snap->regions[page->region];
+		real_memcpy((void *)page->addr, mprot_snap->backing + i * PAGESIZE, PAGESIZE);
+		size_t bit = region->firstpage + (page->addr - region->start) / PAGESIZE;
+		mprot_snap->dirty[bit / 64] &= ~(1ULL << (bit % 64));
+		region->touched = true;
+	}
+	mprot_snap->numdirty = 0;
+
+	mprot_pin_pages();
+	for (unsigned int i = 0;i < mprot_snap->numregions;i++) {
+		struct mprot_region *region = &mprot_snap->regions[i];
+		if (region->touched) {
+			region->touched = false;
+			mprot_protect_region(i);
+		}
+	}
+
+	setcontext(&shared_ctxt);
+}
+
+static void mprot_roll_back(snapshot_id theID)
+{
+	DEBUG("Rollback\n");
+	/* Leave the stacks of this execution, which get unmapped or restored */
+	create_context(&mprot_snap->restore_ctxt, fork_snap->mStackBase, fork_snap->mStackSize, mprot_restore);
+	setcontext(&mprot_snap->restore_ctxt);
+}
+
 /**
  * @brief Initializes the snapshot system
- * @param entryPoint the function that should run the program.
+ * @param numheappages The initial size of the snapshotting heap, in pages
  */
 void snapshot_system_init(unsigned int numheappages)
 {
-	fork_snapshot_init(numheappages);
+	/* The model-checker is created in the shared memory, so the options
+	 * that size it are parsed before the rest */
+	struct model_params params;
+	init_memory_ops();
+	param_defaults(&params);
+	parse_memory_options(&params);
+	fork_snapshot_init(numheappages, (size_t)params.sharedmemory << 20, (size_t)params.modelstack << 20);
+}
+
+/** @brief Count the committed bytes in a part of the shared memory */
+static size_t shared_resident(char *start, size_t size)
+{
+	unsigned char vec[4096];
+	size_t pages = size / PAGESIZE, resident = 0;
+	for (size_t page = 0;page < pages;page += sizeof(vec)) {
+		size_t num = pages - page < sizeof(vec) ? pages - page : sizeof(vec);
+		if (mincore(start + page * PAGESIZE, num * PAGESIZE, vec) != 0)
+			return 0;
+		for (size_t i = 0;i < num;i++)
+			resident += vec[i] & 1;
+	}
+	return resident * PAGESIZE;
+}
+
+/**
+ * @brief Measure how much of the shared memory was used
+ *
+ * Pages of the shared memory are never given back once committed, so what
+ * is committed now is the peak.
+ * @param shared Returns the bytes used by the shared heap
+ * @param stack Returns the bytes used by the model-checker's stack
+ */
+void snapshot_shared_usage(size_t *shared, size_t *stack)
+{
+	*shared = shared_resident((char *)fork_snap, fork_snap->mSharedSize);
+	*stack = shared_resident((char *)fork_snap->mStackBase, fork_snap->mStackSize);
 }
 
 void startExecution() {
-	fork_startExecution();
+	if (model->params.snapshot == SNAPSHOT_FORK)
+		fork_startExecution();
 }
 
 /** Takes a snapshot of memory.
@@ -205,6 +1192,8 @@ void startExecution() {
  */
 snapshot_id take_snapshot()
 {
+	if (model->params.snapshot != SNAPSHOT_FORK)
+		return mprot_take_snapshot();
 	return fork_take_snapshot();
 }
 
@@ -213,5 +1202,8 @@ snapshot_id take_snapshot()
  */
 void snapshot_roll_back(snapshot_id theID)
 {
-	fork_roll_back(theID);
+	if (model->params.snapshot != SNAPSHOT_FORK)
+		mprot_roll_back(theID);
+	else
+		fork_roll_back(theID);
 }
@@ -172,7 +172,7 @@ public:
 	_Tp getVal() {return val;}
 	sllnode<_Tp> * getNext() {return next;}
 	sllnode<_Tp> * getPrev() {return prev;}
-	SNAPSHOTALLOC;
+	SLABALLOC(sllnode<_Tp>);
 
 private:
 	sllnode<_Tp> * next;
@@ -559,6 +559,10 @@ public:
 		return _size;
 	}
 
+	inline uint getCapacity() const {
+		return capacity;
+	}
+
 	~SnapVector() {
 		snapshot_free(array);
 	}
@@ -201,12 +201,14 @@ private:
 #ifdef TLS
 uintptr_t get_tls_addr();
 void tlsdestructor(void *v);
+void kill_helper_threads(int sig);
 #endif
 
 Thread * thread_current();
 thread_id_t thread_current_id();
 void thread_startup();
 void initMainThread();
+void set_thread_stack_size(size_t size);
 
 static inline thread_id_t thrd_to_id(thrd_t t)
 {
@@ -3,6 +3,7 @@
  */
 
 #include <string.h>
+#include <signal.h>
 
 #include <threads.h>
 #include "mutex.h"
@@ -17,6 +18,8 @@
 #include "clockvector.h"
 
 #include <dlfcn.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #ifdef TLS
 uintptr_t get_tls_addr() {
@@ -36,6 +39,15 @@ static void set_tls_addr(uintptr_t addr) {
 }
 #endif
 
+/** @brief Size of the stack of each thread, in bytes (see --stacksize) */
+static size_t thread_stack_size = STACK_SIZE;
+
+/** @brief Set the size of the stacks of the threads created from now on */
+void set_thread_stack_size(size_t size)
+{
+	thread_stack_size = size;
+}
+
 /** Allocate a stack for a new thread. */
 static void * stack_allocate(size_t size)
 {
@@ -224,7 +236,17 @@ void finalize_helper_thread() {
 void * helper_thread(void * ptr) {
 	Thread * curr_thread = thread_current();
 
+	//take signals on this real thread's own stack, as the helper stack may
+	//be write-protected by the snapshotting (see snapshot.cc)
+	char sigstack[SIGSTACKSIZE];
+	stack_t ss;
+	ss.ss_sp = sigstack;
+	ss.ss_size = SIGSTACKSIZE;
+	ss.ss_flags = 0;
+	sigaltstack(&ss, NULL);
+
 	//build a context for this real thread so we can take it's context
+	model_prefault_context(&curr_thread->helpercontext);
 	int ret = getcontext(&curr_thread->helpercontext);
 	ASSERT(!ret);
 
@@ -236,9 +258,9 @@ void * helper_thread(void * ptr) {
 
 
 	/* Initialize new managed context */
-	curr_thread->helper_stack = stack_allocate(STACK_SIZE);
+	curr_thread->helper_stack = stack_allocate(thread_stack_size);
 	curr_thread->helpercontext.uc_stack.ss_sp = curr_thread->helper_stack;
-	curr_thread->helpercontext.uc_stack.ss_size = STACK_SIZE;
+	curr_thread->helpercontext.uc_stack.ss_size = thread_stack_size;
 	curr_thread->helpercontext.uc_stack.ss_flags = 0;
 	curr_thread->helpercontext.uc_link = NULL;
 	makecontext(&curr_thread->helpercontext, finalize_helper_thread, 0);
@@ -288,6 +310,10 @@ void setup_context() {
 		if (curr_thread->tls != NULL)
 			notdone = false;
 		real_pthread_mutex_unlock(&curr_thread->mutex);
+		/* Let the helper thread run; sched_yield() itself is
+		 * intercepted (see pthread.cc) */
+		if (notdone)
+			syscall(SYS_sched_yield);
 	}
 
 	set_tls_addr((uintptr_t)curr_thread->tls);
@@ -304,14 +330,15 @@ int Thread::create_context()
 {
 	int ret;
 
+	model_prefault_context(&context);
 	ret = getcontext(&context);
 	if (ret)
 		return ret;
 
 	/* Initialize new managed context */
-	stack = stack_allocate(STACK_SIZE);
+	stack = stack_allocate(thread_stack_size);
 	context.uc_stack.ss_sp = stack;
-	context.uc_stack.ss_size = STACK_SIZE;
+	context.uc_stack.ss_size = thread_stack_size;
 	context.uc_stack.ss_flags = 0;
 	context.uc_link = NULL;
 #ifdef TLS
@@ -393,6 +420,27 @@ void Thread::freeResources() {
 	state = THREAD_FREED;
 }
 
+#ifdef TLS
+/**
+ * @brief End the real threads behind the current execution's Threads
+ *
+ * For rolling back without leaving the process.  Switches back to the
+ * initial thread's TLS, then signals each helper thread that was not joined
+ * yet; the signal handler exits the thread without running user code.
+ */
+void kill_helper_threads(int sig)
+{
+	Thread *init_thread = model->getInitThread();
+	set_tls_addr((uintptr_t)init_thread->tls);
+	ModelExecution *execution = model->get_execution();
+	for (unsigned int i = 0;i < execution->get_num_threads();i++) {
+		Thread *t = execution->get_thread(int_to_id(i));
+		if (t != init_thread && !t->is_freed() && t->tls != NULL)
+			pthread_kill(t->thread, sig);
+	}
+}
+#endif
+
 /**
  * @brief Construct a new model-checker Thread
  *
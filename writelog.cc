@@ -0,0 +1,81 @@
+#include "writelog.h"
+#include "action.h"
+
+#define WL_INITIAL_CAPACITY 8
+
+WriteLog::WriteLog() :
+	acts(NULL),
+	seqs(NULL),
+	flags(NULL),
+	head(0),
+	_size(0),
+	capacity(0),
+	holes(0)
+{
+}
+
+WriteLog::~WriteLog() {
+	snapshot_free(acts);
+	snapshot_free(seqs);
+	snapshot_free(flags);
+}
+
+void WriteLog::add(ModelAction *write) {
+	if (_size == capacity) {
+		if (head > 0 || holes > 0)
+			compact();
+		if (_size == capacity) {
+			capacity = capacity ? capacity << 1 : WL_INITIAL_CAPACITY;
+			acts = (ModelAction **)snapshot_realloc(acts, capacity * sizeof(ModelAction *));
+			seqs = (modelclock_t *)snapshot_realloc(seqs, capacity * sizeof(modelclock_t));
+			flags = (uint8_t *)snapshot_realloc(flags, capacity * sizeof(uint8_t));
+		}
+	}
+	acts[_size] = write;
+	seqs[_size] = write->get_seq_number();
+	flags[_size] = write->is_seqcst() ? WL_SEQCST : 0;
+	_size++;
+}
+
+/** Removes a write; writes are usually removed oldest first. */
+void WriteLog::remove(ModelAction *write) {
+	modelclock_t seq = write->get_seq_number();
+	uint i;
+	for (i = head;i < _size;i++)
+		if (seqs[i] == seq && acts[i] == write)
+			break;
+	if (i == _size)
+		return;
+
+	acts[i] = NULL;
+	if (i == head) {
+		head++;
+		/* Absorb the holes that now lead the log */
+		while (head < _size && acts[head] == NULL) {
+			head++;
+			holes--;
+		}
+	} else
+		holes++;
+
+	if (head == _size) {
+		head = _size = holes = 0;
+	} else if (holes > (_size - head) / 2)
+		compact();
+}
+
+/** Moves the live entries to the front of the arrays. */
+void WriteLog::compact() {
+	uint to = 0;
+	for (uint i = head;i < _size;i++) {
+		if (acts[i] == NULL)
+			continue;
+		acts[to] = acts[i];
+		seqs[to] = seqs[i];
+		flags[to] = flags[i];
+		to++;
+	}
+	head = 0;
+	_size = to;
+	holes = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef WRITELOG_H
+#define WRITELOG_H
+
+#include "classlist.h"
+#include "mymemory.h"
+#include "modeltypes.h"
+
+/** @brief Flag in WriteLog::flags: the write is seq_cst */
+#define WL_SEQCST 0x1
+
+/**
+ * @brief The writes one thread performed on one location, oldest first.
+ *
+ * Stored as parallel arrays so that scans (see
+ * ModelExecution::build_may_read_from) can test the sequence number and
+ * memory order of each write without touching its ModelAction.  Removed
+ * writes leave a NULL hole; holes at the front are skipped by moving head,
+ * and the arrays are compacted once holes make up half of them.
+ */
+class WriteLog {
+public:
+	WriteLog();
+	~WriteLog();
+	void add(ModelAction *write);
+	void remove(ModelAction *write);
+
+	/** @brief Index of the oldest entry */
+	uint begin() const { return head; }
+	/** @brief One past the index of the newest entry */
+	uint end() const { return _size; }
+	/** @return The write at index i, or NULL if it was removed */
+	ModelAction * getAction(uint i) const { return acts[i]; }
+	modelclock_t getSeq(uint i) const { return seqs[i]; }
+	bool isSeqCst(uint i) const { return flags[i] & WL_SEQCST; }
+
+	SNAPSHOTALLOC;
+
+private:
+	void compact();
+
+	ModelAction **acts;
+	modelclock_t *seqs;
+	uint8_t *flags;
+
+	uint head;
+	uint _size;
+	uint capacity;
+	/** @brief Number of holes in [head, _size) */
+	uint holes;
+};
+#endif